@@ -0,0 +1,567 @@
+#!/usr/bin/env python3
+"""
+Host tool for the binary protocol of HVProgrammer.cpp.
+
+Requests are pipelined: up to --window bytes of request frames are sent ahead while the programmer still executes
+the oldest one, so the USB round trip is paid once per window and not once per command.
+The window must fit into the serial receive buffer of the Nano, a 64 byte ring which holds 63 bytes.
+The oldest frame in flight is not counted, since it is already read by the programmer while it is executed.
+So short requests like read fuses, read flash or verify are pipelined, but a write flash page frame of a part
+with 64 byte pages is larger than the window and is sent only after the previous response.
+Verify flash pages requests carry only as many page CRCs as fit into the window, so they are pipelined too.
+
+Several --port options run the same job on several programmers at once, one thread per port.
+
+Examples:
+  hvprog.py -p /dev/ttyUSB0 identify
+  hvprog.py -p /dev/ttyUSB0 program blink.hex
+  hvprog.py -p /dev/ttyUSB0 program --text blink.hex      # stream through the text command 'p'
+  hvprog.py -p /dev/ttyUSB0 -p /dev/ttyUSB1 batch blink.hex --fuses 62 DF FF
+  hvprog.py -p /dev/ttyUSB0 stats --save
+
+Requires pyserial.
+"""
+import argparse
+import collections
+import struct
+import sys
+import threading
+import time
+import zlib
+
+import serial
+
+FRAME_SYNC = 0xA5
+FRAME_HEADER_SIZE = 4
+FRAME_CRC_SIZE = 2
+OPCODE_RESPONSE = 0x80
+DEFAULT_WINDOW = 63  # The 64 byte receive ring buffer of HardwareSerial holds 63 bytes
+# Loading and writing of one page by the text command 'p'. Datasheet write time is 4.5 ms
+TEXT_PAGE_WRITE_SECONDS = 0.01
+MIN_PROTOCOL_VERSION = 3  # Power up returns the part data
+
+OPCODE_GET_VERSION = 0x01
+OPCODE_POWER_UP = 0x02
+OPCODE_POWER_DOWN = 0x03
+OPCODE_READ_SIGNATURE = 0x04
+OPCODE_READ_FUSES = 0x05
+OPCODE_WRITE_FUSE = 0x06
+OPCODE_CHIP_ERASE = 0x07
+OPCODE_READ_FLASH = 0x08
+OPCODE_WRITE_FLASH_PAGE = 0x09
+OPCODE_READ_EEPROM = 0x0A
+OPCODE_WRITE_EEPROM = 0x0B
+OPCODE_IDENTIFY = 0x0C
+OPCODE_VERIFY_FLASH = 0x0F
+OPCODE_VERIFY_FLASH_PAGES = 0x10
+OPCODE_BLANK_CHECK = 0x11
+OPCODE_READ_STATISTICS = 0x12
+OPCODE_CLEAR_STATISTICS = 0x13
+OPCODE_SAVE_STATISTICS = 0x14
+
+STATUS_OK = 0x00
+STATUS_NAMES = {0x00: "ok", 0x01: "timeout", 0x10: "CRC error", 0x11: "unknown opcode", 0x12: "invalid argument",
+                0x13: "no device", 0x14: "verify error", 0x15: "not blank"}
+
+# struct Statistics of HVProgrammer.cpp
+STATISTICS_SIGNATURES = 4
+STATISTICS_FORMAT = "<HHHIH4HII" + "HHH" * STATISTICS_SIGNATURES
+TIMEOUT_NAMES = ("read", "write", "erase", "watchdog")
+
+BATCH_POLL_INTERVAL = 0.2
+BATCH_STABLE_POLLS = 2
+
+
+class ProtocolError(Exception):
+    pass
+
+
+class CommandError(Exception):
+    def __init__(self, opcode, status):
+        Exception.__init__(self, "command 0x%02X failed: %s" % (opcode, STATUS_NAMES.get(status, "status 0x%02X" % status)))
+        self.opcode = opcode
+        self.status = status
+
+
+def crc16(data):
+    """CRC-16/MCRF4XX, the same as _crc_ccitt_update() with start value 0xFFFF"""
+    crc = 0xFFFF
+    for byte in data:
+        byte ^= crc & 0xFF
+        byte = (byte ^ (byte << 4)) & 0xFF
+        crc = ((byte << 8) | (crc >> 8)) ^ (byte >> 4) ^ (byte << 3)
+    return crc & 0xFFFF
+
+
+class Programmer:
+    def __init__(self, port, baudrate=115200, window=DEFAULT_WINDOW, timeout=2.0):
+        self.port = port
+        self.window = window
+        self.timeout = timeout
+        self.serial = serial.Serial(port, baudrate, timeout=0.05)
+        self.sequence = 0
+        self.in_flight = collections.deque()  # (sequence number, opcode, frame size)
+        self.rx = bytearray()
+        self._completed = collections.deque()  # Responses received by submit() while waiting for window space
+        self.max_payload = 0  # Until get version is answered
+        self._wait_for_start()
+        version = self.command(OPCODE_GET_VERSION)
+        if version[0] < MIN_PROTOCOL_VERSION:
+            raise ProtocolError("%s: protocol version %d, at least %d is required" % (port, version[0], MIN_PROTOCOL_VERSION))
+        self.version = "%d.%d" % (version[1], version[2])
+        self.max_payload = version[3]
+
+    def close(self):
+        try:
+            self.command(OPCODE_POWER_DOWN)
+        finally:
+            self.serial.close()
+
+    def _wait_for_start(self):
+        """Opening the port resets the Nano. Skip the start text, which ends with a pause of the output."""
+        deadline = time.monotonic() + 3.0
+        last_rx = None
+        while time.monotonic() < deadline:
+            data = self.serial.read(256)
+            if data:
+                last_rx = time.monotonic()
+            elif last_rx is not None and time.monotonic() - last_rx > 0.3:
+                break
+        self.serial.reset_input_buffer()
+
+    # Pipelining
+
+    def submit(self, opcode, payload=b""):
+        """Send a request as soon as it fits into the window. Returns its sequence number."""
+        if len(payload) > self.max_payload:
+            raise ValueError("payload of %d bytes exceeds max payload size %d" % (len(payload), self.max_payload))
+        size = FRAME_HEADER_SIZE + len(payload) + FRAME_CRC_SIZE
+        while self.in_flight and (sum(f[2] for f in list(self.in_flight)[1:]) + size > self.window or len(self.in_flight) >= 128):
+            self._completed.append(self._receive())
+        sequence = self.sequence
+        self.sequence = (self.sequence + 1) & 0xFF
+        frame = bytes((sequence, opcode, len(payload))) + bytes(payload)
+        crc = crc16(frame)
+        self.serial.write(bytes((FRAME_SYNC,)) + frame + bytes((crc & 0xFF, crc >> 8)))
+        self.in_flight.append((sequence, opcode, size))
+        return sequence
+
+    def pipeline(self, requests):
+        """Execute (opcode, payload) requests with a window of requests in flight.
+        Yields (opcode, status, data) in request order. Raises CommandError at the first failed command,
+        after the responses of all requests sent so far are received."""
+        self._completed = collections.deque()
+        failure = None
+        requests = iter(requests)
+        for opcode, payload in requests:
+            self.submit(opcode, payload)
+            while self._completed:
+                response = self._completed.popleft()
+                if response[1] != STATUS_OK and failure is None:
+                    failure = response
+                if failure is None:
+                    yield response
+            if failure is not None:
+                break
+        while self.in_flight or self._completed:
+            response = self._completed.popleft() if self._completed else self._receive()
+            if response[1] != STATUS_OK and failure is None:
+                failure = response
+            if failure is None:
+                yield response
+        if failure is not None:
+            raise CommandError(failure[0], failure[1])
+
+    def command(self, opcode, payload=b"", allowed_status=(STATUS_OK,)):
+        """Stop and wait execution of a single command. Returns the response data."""
+        self._completed = collections.deque()
+        self.submit(opcode, payload)
+        opcode, status, data = self._receive()
+        if status not in allowed_status:
+            raise CommandError(opcode, status)
+        return data
+
+    def _receive(self):
+        deadline = time.monotonic() + self.timeout
+        while True:
+            frame = self._parse_frame()
+            if frame is not None:
+                sequence, opcode, status, data = frame
+                expected_sequence, expected_opcode, _ = self.in_flight[0]
+                if sequence != expected_sequence or opcode != expected_opcode:
+                    raise ProtocolError("%s: response %d for opcode 0x%02X, expected %d for 0x%02X"
+                                        % (self.port, sequence, opcode, expected_sequence, expected_opcode))
+                self.in_flight.popleft()
+                if status == 0x10:  # Request was corrupted on the line
+                    raise ProtocolError("%s: programmer received a request with CRC error" % self.port)
+                return opcode, status, data
+            if time.monotonic() > deadline:
+                raise ProtocolError("%s: timeout waiting for response to sequence %d" % (self.port, self.in_flight[0][0]))
+            self.rx += self.serial.read(max(1, self.serial.in_waiting))
+
+    def _parse_frame(self):
+        while True:
+            # Text output, e.g. after a watchdog reset, is skipped up to the next sync byte
+            start = self.rx.find(FRAME_SYNC)
+            if start < 0:
+                del self.rx[:]
+                return None
+            del self.rx[:start]
+            if len(self.rx) < FRAME_HEADER_SIZE + 1:
+                return None
+            length = self.rx[3]
+            size = FRAME_HEADER_SIZE + length + FRAME_CRC_SIZE
+            if len(self.rx) < size:
+                return None
+            crc = self.rx[size - 2] | (self.rx[size - 1] << 8)
+            if length == 0 or not self.rx[2] & OPCODE_RESPONSE or crc16(self.rx[1:size - 2]) != crc:
+                del self.rx[:1]  # No frame, search the next sync byte
+                continue
+            frame = self.rx[:size]
+            del self.rx[:size]
+            return frame[1], frame[2] & ~OPCODE_RESPONSE, frame[4], bytes(frame[5:size - 2])
+
+    # Operations
+
+    def power_up(self):
+        """Returns the signature and (name, flash size, flash page size, number of fuses) of the part,
+        or None if no supported part responds"""
+        data = self.command(OPCODE_POWER_UP, allowed_status=(STATUS_OK, 0x01, 0x13))
+        signature = data[0] | (data[1] << 8)
+        if len(data) < 6:
+            return signature, None
+        flash_size, page_size, number_of_fuses = struct.unpack("<HBB", data[2:6])
+        return signature, (data[6:].decode("ascii", "replace"), flash_size, page_size, number_of_fuses)
+
+    def read_fuses(self):
+        return self.command(OPCODE_READ_FUSES)
+
+    def write_fuses(self, fuses):
+        list(self.pipeline((OPCODE_WRITE_FUSE, bytes((i, value))) for i, value in enumerate(fuses)))
+
+    def read_flash(self, size):
+        chunk = self.max_payload - 1
+        requests = ((OPCODE_READ_FLASH, struct.pack("<HB", address, min(chunk, size - address)))
+                    for address in range(0, size, chunk))
+        return b"".join(data for _, _, data in self.pipeline(requests))
+
+    def program_pages(self, pages, page_size):
+        """Erase and write the pages, which are a dict of page address -> page data. Blank pages are skipped."""
+        self.command(OPCODE_CHIP_ERASE)
+        requests = [(OPCODE_WRITE_FLASH_PAGE, struct.pack("<H", address) + data)
+                    for address, data in sorted(pages.items()) if data != b"\xFF" * page_size]
+        list(self.pipeline(requests))
+        return len(requests)
+
+    def verify_pages(self, pages, page_size, flash_size):
+        """Compare the CRC-32 of each page on the programmer. Pages not in the image must be blank."""
+        blank = b"\xFF" * page_size
+        crcs = [zlib.crc32(pages.get(address, blank)) for address in range(0, flash_size, page_size)]
+        # Address, CRCs and frame overhead must fit into the window, otherwise each request waits for the previous response
+        per_frame = max(1, min(self.max_payload - 2, self.window - FRAME_HEADER_SIZE - FRAME_CRC_SIZE - 2) // 4)
+        requests = []
+        for first in range(0, len(crcs), per_frame):
+            payload = struct.pack("<H", first * page_size) + b"".join(struct.pack("<I", c) for c in crcs[first:first + per_frame])
+            requests.append((OPCODE_VERIFY_FLASH_PAGES, payload))
+        try:
+            list(self.pipeline(requests))
+        except CommandError as error:
+            if error.status == 0x14:
+                return False
+            raise
+        return True
+
+    def read_statistics(self, snapshot=False):
+        values = struct.unpack(STATISTICS_FORMAT, self.command(OPCODE_READ_STATISTICS, b"\x01" if snapshot else b""))
+        statistics = {"cycles": values[0], "passed": values[1], "failed": values[2],
+                      "mean_cycle_ms": values[3] / values[0] if values[0] else 0, "max_cycle_ms": values[4],
+                      "timeouts": dict(zip(TIMEOUT_NAMES, values[5:9])), "programmed_bytes": values[9],
+                      "verified_bytes": values[10], "signatures": {}}
+        for i in range(STATISTICS_SIGNATURES):
+            signature, passed, failed = values[11 + 3 * i:14 + 3 * i]
+            if signature != 0 and signature != 0xFFFF:
+                statistics["signatures"][signature] = (passed, failed)
+        return statistics
+
+    def stream_hex_text(self, hex_lines, page_size):
+        """Program by the text command 'p', which writes each page while the records of the next page are received.
+        The text has no flow control, so it is sent in chunks which fit into the receive buffer of the programmer,
+        each followed by its transfer time. See text_page_pauses() for the additional pauses.
+        Returns the result line of the programmer."""
+        self.serial.write(b"p\r\n")
+        self._wait_for_text(b"Send Intel HEX file now.", 5.0)
+        text, pauses = text_page_pauses(hex_lines, page_size, self.serial.baudrate)
+        for start in range(0, len(text), self.window):
+            chunk = text[start:start + self.window]
+            self.serial.write(chunk)
+            self.serial.flush()
+            pause = sum(seconds for offset, seconds in pauses if start <= offset < start + len(chunk))
+            time.sleep(len(chunk) * 10 / self.serial.baudrate + pause)
+        return self._wait_for_text(b"\n", 15.0, after=(b"pages written", b"Timeout", b"Invalid", b"No valid"))
+
+    def _wait_for_text(self, marker, timeout, after=None):
+        deadline = time.monotonic() + timeout
+        text = bytearray()
+        while time.monotonic() < deadline:
+            text += self.serial.read(max(1, self.serial.in_waiting))
+            if after is None:
+                if marker in text:
+                    return text.decode("ascii", "replace")
+            else:
+                for key in after:
+                    index = text.find(key)
+                    if index >= 0 and text.find(marker, index) >= 0:
+                        line_start = text.rfind(b"\n", 0, index) + 1
+                        return text[line_start:text.find(marker, index)].decode("ascii", "replace").strip()
+        raise ProtocolError("%s: timeout waiting for text output of the programmer" % self.port)
+
+
+def read_intel_hex(filename):
+    """Returns dict of address -> byte"""
+    memory = {}
+    base = 0
+    with open(filename) as file:
+        for number, line in enumerate(file, 1):
+            line = line.strip()
+            if not line:
+                continue
+            if not line.startswith(":"):
+                raise ValueError("%s:%d: missing ':'" % (filename, number))
+            record = bytes.fromhex(line[1:])
+            if len(record) < 5 or len(record) != record[0] + 5 or sum(record) & 0xFF:
+                raise ValueError("%s:%d: invalid record" % (filename, number))
+            address = (record[1] << 8) | record[2]
+            record_type = record[3]
+            data = record[4:-1]
+            if record_type == 0x00:
+                for i, byte in enumerate(data):
+                    memory[base + address + i] = byte
+            elif record_type == 0x01:
+                break
+            elif record_type == 0x02:
+                base = ((data[0] << 8) | data[1]) << 4
+            elif record_type == 0x04:
+                base = ((data[0] << 8) | data[1]) << 16
+    return memory
+
+
+def text_page_pauses(hex_lines, page_size, baudrate):
+    """Returns the HEX text to send and a list of (text offset, seconds) of the required pauses.
+    At the first data byte of a new page, the previous page is handed over for writing and parsing stops
+    until the write of the page before is finished. So a pause is only required if the text of a page
+    is received in less than TEXT_PAGE_WRITE_SECONDS, e.g. for 32 byte pages. 64 byte pages are streamed at line rate."""
+    text = bytearray()
+    pauses = []
+    page = None
+    page_offset = 0
+    for line in hex_lines:
+        line = line.strip()
+        record = bytes.fromhex(line[1:]) if line.startswith(":") else b""
+        if len(record) >= 5 and record[3] == 0x00:
+            address = (record[1] << 8) | record[2]
+            for i in range(record[0]):
+                if (address + i) & ~(page_size - 1) != page:
+                    offset = len(text) + 9 + 2 * i  # ':', byte count, address and type precede the data
+                    if page is not None:
+                        receive_seconds = (offset - page_offset) * 10 / baudrate
+                        if receive_seconds < TEXT_PAGE_WRITE_SECONDS:
+                            pauses.append((offset, TEXT_PAGE_WRITE_SECONDS - receive_seconds))
+                    page = (address + i) & ~(page_size - 1)
+                    page_offset = offset
+        text += line.encode("ascii") + b"\r\n"
+    return bytes(text), pauses
+
+
+def split_pages(memory, page_size, flash_size):
+    pages = {}
+    for address, byte in memory.items():
+        if address >= flash_size:
+            raise ValueError("address 0x%04X is out of flash range" % address)
+        page = pages.setdefault(address & ~(page_size - 1), bytearray(b"\xFF" * page_size))
+        page[address & (page_size - 1)] = byte
+    return {address: bytes(data) for address, data in pages.items()}
+
+
+def require_device(programmer):
+    signature, device = programmer.power_up()
+    if device is None:
+        raise ProtocolError("%s: no supported part found, signature 0x%04X" % (programmer.port, signature))
+    return signature, device
+
+
+# Jobs, each called in its own thread with an open programmer
+
+def job_identify(programmer, args, log):
+    signature, device = require_device(programmer)
+    fuses = programmer.read_fuses()
+    log("%s signature 0x%04X fuses %s" % (device[0], signature, " ".join("%02X" % f for f in fuses[:device[3]])))
+
+
+def job_fuses(programmer, args, log):
+    signature, device = require_device(programmer)
+    if args.write:
+        programmer.write_fuses(args.write[:device[3]])
+    log("fuses %s" % " ".join("%02X" % f for f in programmer.read_fuses()[:device[3]]))
+
+
+def job_read(programmer, args, log):
+    signature, device = require_device(programmer)
+    start = time.monotonic()
+    data = programmer.read_flash(device[1])
+    log("%d bytes read in %.2f s" % (len(data), time.monotonic() - start))
+    with open(args.output, "wb") as file:
+        file.write(data)
+
+
+def program_and_verify(programmer, device, memory, args):
+    pages = split_pages(memory, device[2], device[1])
+    written = programmer.program_pages(pages, device[2])
+    if not programmer.verify_pages(pages, device[2], device[1]):
+        return "verify error"
+    if args.fuses:
+        programmer.write_fuses(args.fuses[:device[3]])
+        if list(programmer.read_fuses()[:device[3]]) != list(args.fuses[:device[3]]):
+            return "fuse verify error"
+    return "%d pages written, %d blank pages skipped" % (written, len(range(0, device[1], device[2])) - written)
+
+
+def job_program(programmer, args, log):
+    start = time.monotonic()
+    if args.text:
+        signature, device = require_device(programmer)
+        programmer.command(OPCODE_POWER_DOWN)  # 'p' powers the part up itself
+        with open(args.hexfile) as file:
+            log(programmer.stream_hex_text(file.readlines(), device[2]))
+        return
+    signature, device = require_device(programmer)
+    log("%s: %s in %.2f s" % (device[0], program_and_verify(programmer, device, read_intel_hex(args.hexfile), args),
+                               time.monotonic() - start))
+
+
+def job_batch(programmer, args, log):
+    """Program one chip after the other, like the batch mode 'c' of the text UI"""
+    memory = read_intel_hex(args.hexfile)
+    passed = failed = 0
+    try:
+        while args.count == 0 or passed + failed < args.count:
+            log("Ready for chip %d" % (passed + failed + 1))
+            device = wait_for_socket(programmer, True)
+            start = time.monotonic()
+            try:
+                result = program_and_verify(programmer, device, memory, args)
+                success = not result.endswith("error")
+            except (CommandError, ProtocolError) as error:
+                result = str(error)
+                success = False
+            if success:
+                passed += 1
+            else:
+                failed += 1
+            log("%s %s: %s in %.2f s" % ("PASS" if success else "FAIL", device[0], result, time.monotonic() - start))
+            programmer.command(OPCODE_POWER_DOWN)
+            wait_for_socket(programmer, False)
+    finally:
+        log("Batch stopped. Passed: %d Failed: %d" % (passed, failed))
+
+
+def wait_for_socket(programmer, inserted):
+    """Poll until a part is inserted or removed for BATCH_STABLE_POLLS consecutive polls.
+    Between polls VCC and 12 V are off. After an insertion the part stays powered."""
+    stable = 0
+    while True:
+        _, device = programmer.power_up()
+        if (device is not None) == inserted:
+            stable += 1
+            if stable >= BATCH_STABLE_POLLS:
+                return device
+        else:
+            stable = 0
+        programmer.command(OPCODE_POWER_DOWN)
+        time.sleep(BATCH_POLL_INTERVAL)
+
+
+def job_stats(programmer, args, log):
+    if args.save:
+        programmer.command(OPCODE_SAVE_STATISTICS)
+    statistics = programmer.read_statistics(args.snapshot)
+    if args.clear:
+        programmer.command(OPCODE_CLEAR_STATISTICS)
+    log("cycles %(cycles)d passed %(passed)d failed %(failed)d mean %(mean_cycle_ms).0f ms max %(max_cycle_ms)d ms" % statistics)
+    log("timeouts " + " ".join("%s %d" % item for item in statistics["timeouts"].items()))
+    log("programmed %(programmed_bytes)d bytes verified %(verified_bytes)d bytes" % statistics)
+    for signature, (passed, failed) in statistics["signatures"].items():
+        log("signature 0x%04X passed %d failed %d" % (signature, passed, failed))
+
+
+def run_on_port(port, args, job, print_lock, results):
+    def log(text):
+        with print_lock:
+            print("%s: %s" % (port, text) if len(args.port) > 1 else text)
+            sys.stdout.flush()
+
+    try:
+        programmer = Programmer(port, args.baudrate, args.window)
+        try:
+            job(programmer, args, log)
+        finally:
+            programmer.close()
+        results[port] = True
+    except (serial.SerialException, ProtocolError, CommandError, ValueError, OSError) as error:
+        log("error: %s" % error)
+        results[port] = False
+
+
+def parse_fuses(text):
+    return int(text, 16)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0].strip(),
+                                     formatter_class=argparse.RawDescriptionHelpFormatter, epilog=__doc__.split("\n\n", 1)[1])
+    parser.add_argument("-p", "--port", action="append", required=True, help="serial port, repeat for several programmers")
+    parser.add_argument("-b", "--baudrate", type=int, default=115200)
+    parser.add_argument("-w", "--window", type=int, default=DEFAULT_WINDOW,
+                        help="bytes of requests sent ahead, default %d" % DEFAULT_WINDOW)
+    commands = parser.add_subparsers(dest="command", required=True)
+
+    commands.add_parser("identify", help="print part, signature and fuses").set_defaults(job=job_identify)
+    subparser = commands.add_parser("fuses", help="read or write fuses")
+    subparser.add_argument("--write", nargs="+", type=parse_fuses, metavar="HEX", help="low, high and extended fuse")
+    subparser.set_defaults(job=job_fuses)
+    subparser = commands.add_parser("read", help="read flash to a binary file")
+    subparser.add_argument("output")
+    subparser.set_defaults(job=job_read)
+    for name, job, text in (("program", job_program, "erase, program and verify flash"),
+                            ("batch", job_batch, "program one chip after the other")):
+        subparser = commands.add_parser(name, help=text)
+        subparser.add_argument("hexfile")
+        subparser.add_argument("--fuses", nargs="+", type=parse_fuses, metavar="HEX",
+                               help="fuses to write after programming")
+        subparser.set_defaults(job=job)
+    commands.choices["program"].add_argument("--text", action="store_true",
+                                             help="stream the HEX file through the text command 'p' instead of binary frames")
+    commands.choices["batch"].add_argument("--count", type=int, default=0, help="stop after this number of chips")
+    subparser = commands.add_parser("stats", help="print session statistics")
+    subparser.add_argument("--snapshot", action="store_true", help="print the snapshot in the EEPROM of the programmer")
+    subparser.add_argument("--save", action="store_true", help="store the running counters as snapshot before printing")
+    subparser.add_argument("--clear", action="store_true", help="clear the running counters after printing")
+    subparser.set_defaults(job=job_stats)
+    args = parser.parse_args()
+
+    print_lock = threading.Lock()
+    results = {}
+    threads = [threading.Thread(target=run_on_port, args=(port, args, args.job, print_lock, results), daemon=True)
+               for port in args.port]
+    for thread in threads:
+        thread.start()
+    try:
+        for thread in threads:
+            while thread.is_alive():
+                thread.join(0.2)
+    except KeyboardInterrupt:
+        return 130
+    return 0 if all(results.get(port) for port in args.port) else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,26 @@
+/*
+ * HVSPHostPinIO.h
+ *
+ * Forced include for the host build of HVProgrammer.cpp with HVSP_EXTERNAL_PIN_IO.
+ * Connects the fastDigital*() and fastPinMode*() macros of the HVSP layer to the simulated pins of HostCore.cpp,
+ * with the cycles of the direct port access of the Nano.
+ */
+#ifndef HVSP_HOST_PIN_IO_H_
+#define HVSP_HOST_PIN_IO_H_
+
+#include <Arduino.h>
+#include "HostCore.h"
+
+#define fastDigitalWriteHigh(aPin) hostWritePin(aPin, HIGH, HOST_CYCLES_FAST_PIN_ACCESS)
+#define fastDigitalWriteLow(aPin) hostWritePin(aPin, LOW, HOST_CYCLES_FAST_PIN_ACCESS)
+#define fastDigitalRead(aPin) (hostReadPin(aPin, HOST_CYCLES_FAST_PIN_ACCESS) != LOW)
+#define fastPinModeOutput(aPin) hostSetPinMode(aPin, OUTPUT, HOST_CYCLES_FAST_PIN_ACCESS)
+#define fastPinModeInput(aPin) hostSetPinMode(aPin, INPUT, HOST_CYCLES_FAST_PIN_ACCESS)
+
+/*
+ * avr-gcc does not pad structures. Without packing, struct Statistics would be 56 instead of 52 bytes on the host
+ * and the binary protocol would return another layout than the Nano.
+ */
+#pragma pack(1)
+
+#endif // HVSP_HOST_PIN_IO_H_
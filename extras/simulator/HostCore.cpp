@@ -0,0 +1,382 @@
+/*
+ * HostCore.cpp
+ *
+ * Simulated Nano for the HVProgrammer simulator, see HostCore.h and Arduino.h
+ */
+#include <deque>
+#include <string>
+#include <Arduino.h>
+
+#include "HostCore.h"
+#include "TargetModel.h"
+
+void setup();
+void loop();
+
+HardwareSerial Serial;
+
+uint64_t sHostCycles;
+bool sHostInterruptsEnabled = true;
+
+struct HostPin {
+    uint8_t Mode;
+    uint8_t Level; // Output level, or pull-up enabled for an input
+    uint8_t InputLevel; // Of an input which is not connected to the target
+};
+HostPin sHostPins[NUMBER_OF_PINS];
+
+struct HostReceivedByte {
+    uint64_t ArrivalCycles;
+    uint8_t Value;
+};
+std::deque<HostReceivedByte> sHostSerialInput; // Not yet arrived
+uint64_t sHostLastArrivalCycles;
+uint8_t sHostRxBuffer[SERIAL_RX_BUFFER_SIZE];
+uint8_t sHostRxHead;
+uint8_t sHostRxTail;
+uint8_t sHostUSARTCount; // Arrived while interrupts were disabled
+uint8_t sHostUSARTBuffer[HOST_USART_BUFFER_SIZE];
+uint16_t sHostNumberOfLostBytes;
+uint32_t sHostByteCycles = F_CPU * 10 / 115200; // Start, 8 data and stop bit
+uint64_t sHostTxIdleCycles; // Time the transmitter has sent all buffered bytes
+std::string sHostOutput;
+void (*sHostPollFunction)();
+uint64_t sHostPollIntervalCycles;
+uint64_t sHostNextPollCycles;
+
+extern uint8_t __start_host_eeprom[] __attribute__((weak));
+extern uint8_t __stop_host_eeprom[] __attribute__((weak));
+
+static void storeReceivedByte(uint8_t aValue) {
+    uint8_t tNextHead = (sHostRxHead + 1) % SERIAL_RX_BUFFER_SIZE;
+    if (tNextHead == sHostRxTail) {
+        sHostNumberOfLostBytes++; // Like HardwareSerial, the ring keeps one place free
+        return;
+    }
+    sHostRxBuffer[sHostRxHead] = aValue;
+    sHostRxHead = tNextHead;
+}
+
+/*
+ * Move the bytes which arrived until now into the receive buffer, as the receive interrupt does
+ */
+static void receiveArrivedBytes() {
+    while (!sHostSerialInput.empty() && sHostSerialInput.front().ArrivalCycles <= sHostCycles) {
+        uint8_t tValue = sHostSerialInput.front().Value;
+        sHostSerialInput.pop_front();
+        if (sHostInterruptsEnabled) {
+            storeReceivedByte(tValue);
+        } else if (sHostUSARTCount < HOST_USART_BUFFER_SIZE) {
+            sHostUSARTBuffer[sHostUSARTCount++] = tValue;
+        } else {
+            sHostNumberOfLostBytes++; // Data overrun of the USART
+        }
+    }
+}
+
+void hostDelayCycles(uint32_t aCycles) {
+    sHostCycles += aCycles;
+    if (sHostPollFunction != NULL && sHostCycles >= sHostNextPollCycles) {
+        sHostNextPollCycles = sHostCycles + sHostPollIntervalCycles;
+        sHostPollFunction();
+    }
+    receiveArrivedBytes();
+}
+
+void hostSetPollFunction(void (*aPollFunction)(), uint32_t aIntervalMicros) {
+    sHostPollFunction = aPollFunction;
+    sHostPollIntervalCycles = (uint64_t) aIntervalMicros * HOST_CYCLES_PER_MICROSECOND;
+    sHostNextPollCycles = sHostCycles;
+}
+
+uint64_t hostCycles() {
+    return sHostCycles;
+}
+
+uint32_t hostMicros() {
+    return sHostCycles / HOST_CYCLES_PER_MICROSECOND;
+}
+
+uint32_t micros() {
+    hostDelayCycles(HOST_CYCLES_TIME_READ);
+    return hostMicros();
+}
+
+uint32_t millis() {
+    hostDelayCycles(HOST_CYCLES_TIME_READ);
+    return sHostCycles / (HOST_CYCLES_PER_MICROSECOND * 1000);
+}
+
+void delay(uint32_t aMillis) {
+    hostDelayCycles(aMillis * HOST_CYCLES_PER_MICROSECOND * 1000);
+}
+
+void delayMicroseconds(unsigned int aMicros) {
+    hostDelayCycles(aMicros * HOST_CYCLES_PER_MICROSECOND);
+}
+
+void noInterrupts() {
+    sHostInterruptsEnabled = false;
+}
+
+void interrupts() {
+    sHostInterruptsEnabled = true;
+    for (uint8_t i = 0; i < sHostUSARTCount; ++i) {
+        storeReceivedByte(sHostUSARTBuffer[i]);
+    }
+    sHostUSARTCount = 0;
+}
+
+/*
+ * Pins
+ */
+void hostWritePin(uint8_t aPin, uint8_t aValue, uint8_t aCycles) {
+    hostDelayCycles(aCycles);
+    HostPin *tPin = &sHostPins[aPin];
+    uint8_t tOldLevel = hostPinLevel(aPin);
+    tPin->Level = aValue;
+    if (hostPinLevel(aPin) != tOldLevel) {
+        targetPinChanged(aPin, hostPinLevel(aPin));
+    }
+}
+
+uint8_t hostReadPin(uint8_t aPin, uint8_t aCycles) {
+    hostDelayCycles(aCycles);
+    HostPin *tPin = &sHostPins[aPin];
+    if (tPin->Mode == OUTPUT) {
+        return tPin->Level;
+    }
+    if (aPin == TARGET_PIN_SDO) {
+        return targetSDOLevel();
+    }
+    return tPin->InputLevel;
+}
+
+void hostSetPinMode(uint8_t aPin, uint8_t aMode, uint8_t aCycles) {
+    hostDelayCycles(aCycles);
+    HostPin *tPin = &sHostPins[aPin];
+    uint8_t tOldLevel = hostPinLevel(aPin);
+    if (aMode == INPUT_PULLUP) {
+        tPin->Mode = INPUT;
+        tPin->Level = HIGH;
+    } else {
+        tPin->Mode = aMode;
+    }
+    if (hostPinLevel(aPin) != tOldLevel) {
+        targetPinChanged(aPin, hostPinLevel(aPin));
+    }
+}
+
+bool hostIsPinOutput(uint8_t aPin) {
+    return sHostPins[aPin].Mode == OUTPUT;
+}
+
+/*
+ * An input is seen as LOW by the target
+ */
+uint8_t hostPinLevel(uint8_t aPin) {
+    return hostIsPinOutput(aPin) ? sHostPins[aPin].Level : LOW;
+}
+
+void hostSetInputLevel(uint8_t aPin, uint8_t aLevel) {
+    sHostPins[aPin].InputLevel = aLevel;
+}
+
+void pinMode(uint8_t aPin, uint8_t aMode) {
+    hostSetPinMode(aPin, aMode, HOST_CYCLES_DIGITAL_WRITE);
+}
+
+void digitalWrite(uint8_t aPin, uint8_t aValue) {
+    hostWritePin(aPin, aValue, HOST_CYCLES_DIGITAL_WRITE);
+}
+
+int digitalRead(uint8_t aPin) {
+    return hostReadPin(aPin, HOST_CYCLES_DIGITAL_READ);
+}
+
+/*
+ * Serial
+ */
+void hostSend(const void *aData, size_t aLength) {
+    hostSendAfterPause(0, aData, aLength);
+}
+
+void hostSendAfterPause(uint32_t aPauseMicros, const void *aData, size_t aLength) {
+    const uint8_t *tData = (const uint8_t*) aData;
+    if (sHostLastArrivalCycles < sHostCycles) {
+        sHostLastArrivalCycles = sHostCycles;
+    }
+    sHostLastArrivalCycles += (uint64_t) aPauseMicros * HOST_CYCLES_PER_MICROSECOND;
+    for (size_t i = 0; i < aLength; ++i) {
+        sHostLastArrivalCycles += sHostByteCycles;
+        sHostSerialInput.push_back( { sHostLastArrivalCycles, tData[i] });
+    }
+}
+
+void hostSendText(const char *aText) {
+    hostSend(aText, strlen(aText));
+}
+
+uint16_t hostNumberOfLostBytes() {
+    return sHostNumberOfLostBytes;
+}
+
+const char* hostOutput() {
+    return sHostOutput.c_str();
+}
+
+size_t hostOutputLength() {
+    return sHostOutput.size();
+}
+
+void hostClearOutput() {
+    sHostOutput.clear();
+}
+
+void HardwareSerial::begin(uint32_t aBaudrate) {
+    sHostByteCycles = F_CPU * 10 / aBaudrate;
+}
+
+int HardwareSerial::available() {
+    hostDelayCycles(HOST_CYCLES_SERIAL_ACCESS);
+    return (SERIAL_RX_BUFFER_SIZE + sHostRxHead - sHostRxTail) % SERIAL_RX_BUFFER_SIZE;
+}
+
+int HardwareSerial::peek() {
+    hostDelayCycles(HOST_CYCLES_SERIAL_ACCESS);
+    if (sHostRxHead == sHostRxTail) {
+        return -1;
+    }
+    return sHostRxBuffer[sHostRxTail];
+}
+
+int HardwareSerial::read() {
+    int tValue = peek();
+    if (tValue >= 0) {
+        sHostRxTail = (sHostRxTail + 1) % SERIAL_RX_BUFFER_SIZE;
+    }
+    return tValue;
+}
+
+/*
+ * Wait while the transmit buffer is full, then the byte is sent after all buffered bytes
+ */
+size_t HardwareSerial::write(uint8_t aByte) {
+    hostDelayCycles(HOST_CYCLES_SERIAL_ACCESS);
+    uint64_t tBufferFullCycles = (uint64_t) SERIAL_TX_BUFFER_SIZE * sHostByteCycles;
+    if (sHostTxIdleCycles > sHostCycles + tBufferFullCycles) {
+        hostDelayCycles(sHostTxIdleCycles - tBufferFullCycles - sHostCycles);
+    }
+    if (sHostTxIdleCycles < sHostCycles) {
+        sHostTxIdleCycles = sHostCycles;
+    }
+    sHostTxIdleCycles += sHostByteCycles;
+    sHostOutput += (char) aByte;
+    return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t *aBuffer, size_t aLength) {
+    for (size_t i = 0; i < aLength; ++i) {
+        write(aBuffer[i]);
+    }
+    return aLength;
+}
+
+size_t HardwareSerial::print(const __FlashStringHelper *aText) {
+    return print(reinterpret_cast<const char*>(aText));
+}
+
+size_t HardwareSerial::print(const char *aText) {
+    return write((const uint8_t*) aText, strlen(aText));
+}
+
+size_t HardwareSerial::print(char aCharacter) {
+    return write(aCharacter);
+}
+
+size_t HardwareSerial::print(unsigned char aValue, int aBase) {
+    return printNumber(aValue, aBase);
+}
+
+size_t HardwareSerial::print(int aValue, int aBase) {
+    return print((long) aValue, aBase);
+}
+
+size_t HardwareSerial::print(unsigned int aValue, int aBase) {
+    return printNumber(aValue, aBase);
+}
+
+size_t HardwareSerial::print(long aValue, int aBase) {
+    if (aValue < 0 && aBase == DEC) {
+        return write('-') + printNumber(-aValue, aBase);
+    }
+    return printNumber(aValue, aBase);
+}
+
+size_t HardwareSerial::print(unsigned long aValue, int aBase) {
+    return printNumber(aValue, aBase);
+}
+
+size_t HardwareSerial::println() {
+    return print("\r\n");
+}
+
+size_t HardwareSerial::printNumber(unsigned long aValue, int aBase) {
+    char tBuffer[8 * sizeof(long) + 1];
+    char *tText = &tBuffer[sizeof(tBuffer) - 1];
+    *tText = '\0';
+    do {
+        uint8_t tDigit = aValue % aBase;
+        aValue /= aBase;
+        *--tText = tDigit < 10 ? '0' + tDigit : 'A' + tDigit - 10;
+    } while (aValue != 0);
+    return print(tText);
+}
+
+/*
+ * Run the sketch
+ */
+void hostStart() {
+    sHostCycles = 0;
+    sHostInterruptsEnabled = true;
+    for (uint8_t i = 0; i < NUMBER_OF_PINS; ++i) {
+        sHostPins[i].Mode = INPUT;
+        sHostPins[i].Level = LOW;
+        sHostPins[i].InputLevel = HIGH;
+    }
+    sHostSerialInput.clear();
+    sHostLastArrivalCycles = 0;
+    sHostRxHead = 0;
+    sHostRxTail = 0;
+    sHostUSARTCount = 0;
+    sHostNumberOfLostBytes = 0;
+    sHostTxIdleCycles = 0;
+    sHostOutput.clear();
+    if (__start_host_eeprom != NULL) {
+        memset(__start_host_eeprom, 0xFF, __stop_host_eeprom - __start_host_eeprom);
+    }
+    setup();
+}
+
+void hostRunLoop() {
+    hostDelayCycles(HOST_CYCLES_LOOP);
+    loop();
+}
+
+void hostRunMillis(uint32_t aMillis) {
+    uint64_t tEndCycles = sHostCycles + (uint64_t) aMillis * HOST_CYCLES_PER_MICROSECOND * 1000;
+    while (sHostCycles < tEndCycles) {
+        hostRunLoop();
+    }
+}
+
+bool hostRunUntilOutput(const char *aText, uint32_t aTimeoutMillis) {
+    uint64_t tEndCycles = sHostCycles + (uint64_t) aTimeoutMillis * HOST_CYCLES_PER_MICROSECOND * 1000;
+    while (sHostOutput.find(aText) == std::string::npos) {
+        if (sHostCycles >= tEndCycles) {
+            return false;
+        }
+        hostRunLoop();
+    }
+    return true;
+}
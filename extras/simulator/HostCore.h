@@ -0,0 +1,82 @@
+/*
+ * HostCore.h
+ *
+ * Simulated clock, pins and serial port of the Nano for running HVProgrammer.cpp on a host.
+ * The clock counts CPU cycles of the 16 MHz ATmega328P. It is advanced by each pin access, each call of the time functions,
+ * the delay functions and each call of loop(), by the approximate number of cycles these take on the Nano.
+ * So the simulated time of a command is comparable with the one of a Nano, independent of the speed of the host.
+ */
+#ifndef HOST_CORE_H_
+#define HOST_CORE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <Arduino.h>
+
+#define HOST_CYCLES_PER_MICROSECOND (F_CPU / 1000000UL)
+#define HOST_CYCLES_FAST_PIN_ACCESS 2 // sbi, cbi or sbic
+#define HOST_CYCLES_DIGITAL_WRITE 56 // Pin table lookup of the Arduino core
+#define HOST_CYCLES_DIGITAL_READ 52
+#define HOST_CYCLES_TIME_READ 20 // millis() and micros() with disabled interrupts
+#define HOST_CYCLES_SERIAL_ACCESS 12
+#define HOST_CYCLES_LOOP 100 // Call of loop() and the checks of an idle runProgrammingSequence()
+#define HOST_USART_BUFFER_SIZE 2 // Bytes received by the USART while interrupts are disabled
+
+uint64_t hostCycles();
+uint32_t hostMicros();
+
+/*
+ * Pin access of the HVSP layer by the fastDigital*() macros, see HVSPHostPinIO.h
+ */
+void hostWritePin(uint8_t aPin, uint8_t aValue, uint8_t aCycles);
+uint8_t hostReadPin(uint8_t aPin, uint8_t aCycles);
+void hostSetPinMode(uint8_t aPin, uint8_t aMode, uint8_t aCycles);
+
+/*
+ * State of the programmer lines, used by the target model
+ */
+bool hostIsPinOutput(uint8_t aPin);
+uint8_t hostPinLevel(uint8_t aPin);
+
+/*
+ * Level of an input which is not connected to the target, e.g. LOW for a pressed button. Default is the pull-up level HIGH.
+ */
+void hostSetInputLevel(uint8_t aPin, uint8_t aLevel);
+
+/*
+ * Queue bytes for the serial input of the sketch. They arrive back to back at the baud rate, after the bytes queued before.
+ */
+void hostSend(const void *aData, size_t aLength);
+/*
+ * The first byte arrives aPauseMicros after the bytes queued before. Used for input which the sketch reads
+ * while it is busy with a command, because loop() does not return to the test before the command is finished.
+ */
+void hostSendAfterPause(uint32_t aPauseMicros, const void *aData, size_t aLength);
+void hostSendText(const char *aText);
+uint16_t hostNumberOfLostBytes(); // Received at a full buffer or while interrupts were disabled too long
+
+/*
+ * Serial output of the sketch since the last hostClearOutput()
+ */
+const char* hostOutput();
+size_t hostOutputLength();
+void hostClearOutput();
+
+/*
+ * Reset the simulated Nano: erased EEPROM, clock 0, all pins input, then setup()
+ */
+void hostStart();
+void hostRunLoop();
+void hostRunMillis(uint32_t aMillis);
+/*
+ * Run loop() until the output contains aText or the timeout expired
+ * @return true if aText was found
+ */
+bool hostRunUntilOutput(const char *aText, uint32_t aTimeoutMillis);
+/*
+ * aPollFunction is called every aIntervalMicros of simulated time, also while the sketch is busy inside loop().
+ * Used by SerialBridge.cpp to exchange the serial data with a pty in real time.
+ */
+void hostSetPollFunction(void (*aPollFunction)(), uint32_t aIntervalMicros);
+
+#endif // HOST_CORE_H_
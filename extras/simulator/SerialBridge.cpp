@@ -0,0 +1,91 @@
+/*
+ * SerialBridge.cpp
+ *
+ * Serial port of the simulated Nano at a pty, see SerialBridge.h
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+
+#include "HostCore.h"
+#include "SerialBridge.h"
+
+#define BRIDGE_POLL_INTERVAL_MICROS 100 // About 1 character at 115200 baud
+#define BRIDGE_MAX_LEAD_MICROS 1000 // Simulated time may run ahead of the wall clock by this time before sleeping
+
+int sBridgeMasterFd;
+pid_t sBridgeParentPid;
+uint64_t sBridgeStartMicros; // Wall clock at start of the sketch
+std::string sBridgeOutput; // Output of the sketch not yet accepted by the pty
+
+static uint64_t getWallMicros() {
+    struct timespec tTime;
+    clock_gettime(CLOCK_MONOTONIC, &tTime);
+    return (uint64_t) tTime.tv_sec * 1000000 + tTime.tv_nsec / 1000;
+}
+
+/*
+ * Called by the host core while the sketch runs
+ */
+static void pollSerialBridge() {
+    uint64_t tWallMicros = getWallMicros() - sBridgeStartMicros;
+    if (hostMicros() > tWallMicros + BRIDGE_MAX_LEAD_MICROS) {
+        usleep(hostMicros() - tWallMicros);
+        if (getppid() != sBridgeParentPid) {
+            exit(0); // Test script has gone
+        }
+    }
+
+    uint8_t tBuffer[256];
+    ssize_t tLength = read(sBridgeMasterFd, tBuffer, sizeof(tBuffer));
+    if (tLength > 0) {
+        hostSend(tBuffer, tLength);
+    }
+
+    if (hostOutputLength() > 0) {
+        sBridgeOutput.append(hostOutput(), hostOutputLength());
+        hostClearOutput();
+    }
+    if (!sBridgeOutput.empty()) {
+        tLength = write(sBridgeMasterFd, sBridgeOutput.data(), sBridgeOutput.size());
+        if (tLength > 0) {
+            sBridgeOutput.erase(0, tLength);
+        }
+    }
+}
+
+bool runSerialBridge() {
+    sBridgeMasterFd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (sBridgeMasterFd < 0 || grantpt(sBridgeMasterFd) != 0 || unlockpt(sBridgeMasterFd) != 0) {
+        perror("pty");
+        return false;
+    }
+    const char *tSlaveName = ptsname(sBridgeMasterFd);
+    /*
+     * Keep the slave open, otherwise reading the master fails after the host tool closes the port.
+     * Raw mode, so no byte of the binary protocol is changed or echoed.
+     */
+    int tSlaveFd = open(tSlaveName, O_RDWR | O_NOCTTY);
+    struct termios tAttributes;
+    if (tSlaveFd < 0 || tcgetattr(tSlaveFd, &tAttributes) != 0) {
+        perror(tSlaveName);
+        return false;
+    }
+    cfmakeraw(&tAttributes);
+    tcsetattr(tSlaveFd, TCSANOW, &tAttributes);
+    fcntl(sBridgeMasterFd, F_SETFL, fcntl(sBridgeMasterFd, F_GETFL) | O_NONBLOCK);
+
+    printf("%s\n", tSlaveName);
+    fflush(stdout);
+    sBridgeParentPid = getppid();
+    sBridgeStartMicros = getWallMicros();
+    hostStart();
+    hostSetPollFunction(&pollSerialBridge, BRIDGE_POLL_INTERVAL_MICROS);
+    while (true) {
+        hostRunLoop();
+    }
+}
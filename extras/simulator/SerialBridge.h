@@ -0,0 +1,16 @@
+/*
+ * SerialBridge.h
+ *
+ * Connects the serial port of the simulated Nano to a pty, so host tools like extras/hvprog.py can talk to the simulator.
+ * The simulated time is kept in step with the wall clock, so the host sees about the timing of a real programmer.
+ */
+#ifndef SERIAL_BRIDGE_H_
+#define SERIAL_BRIDGE_H_
+
+/*
+ * Start the sketch, print the path of the pty to stdout and run until the parent process exits.
+ * @return false if no pty could be created
+ */
+bool runSerialBridge();
+
+#endif // SERIAL_BRIDGE_H_
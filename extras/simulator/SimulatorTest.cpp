@@ -0,0 +1,476 @@
+/*
+ * SimulatorTest.cpp
+ *
+ * Test driver of the HVProgrammer simulator. Each scenario runs HVProgrammer.cpp from reset against the ATtiny model
+ * and checks the serial output, the state of the model and the simulated time.
+ * Call with the name of one scenario, since the globals of the sketch are only initialized at the start of a process.
+ * All scenarios are registered as tests in CMakeLists.txt.
+ * "serve" connects the sketch with an ATtiny85 to a pty for test_hvprog.py, "crc16 <hex bytes>" prints the CRC of the frames.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <Arduino.h>
+#include <util/crc16.h>
+
+#include "HostCore.h"
+#include "SerialBridge.h"
+#include "TargetModel.h"
+
+#define CHECK(aCondition) check((aCondition), #aCondition, __LINE__)
+
+// Binary host protocol, see HVProgrammer.cpp
+#define FRAME_SYNC 0xA5
+#define FRAME_HEADER_SIZE 4
+#define FRAME_CRC_SIZE 2
+#define OPCODE_RESPONSE 0x80
+#define OPCODE_GET_VERSION 0x01
+#define OPCODE_POWER_UP 0x02
+#define OPCODE_POWER_DOWN 0x03
+#define OPCODE_READ_FUSES 0x05
+#define OPCODE_CHIP_ERASE 0x07
+#define OPCODE_READ_FLASH 0x08
+#define OPCODE_WRITE_FLASH_PAGE 0x09
+#define OPCODE_VERIFY_FLASH 0x0F
+#define OPCODE_READ_STATISTICS 0x12
+#define STATUS_OK 0x00
+#define STATUS_CRC_ERROR 0x10
+
+#define STATISTICS_SIZE 52
+#define STATISTICS_NUMBER_OF_CYCLES_OFFSET 0
+#define STATISTICS_NUMBER_OF_FAILED_OFFSET 4
+#define STATISTICS_WRITE_TIMEOUTS_OFFSET 14
+
+#define RECEIVE_WINDOW_SIZE 63 // Like extras/hvprog.py, what the receive buffer of the Nano holds
+#define HEX_PROMPT_WAIT_MILLIS 500 // Until the chip erase is done and the Intel HEX prompt is printed
+
+uint16_t sNumberOfFailedChecks;
+size_t sResponseOffset; // Of the next response frame in the serial output
+
+void check(bool aCondition, const char *aText, int aLine) {
+    if (!aCondition) {
+        printf("SimulatorTest.cpp:%d: check failed: %s\n", aLine, aText);
+        sNumberOfFailedChecks++;
+    }
+}
+
+void printSimulatedTime(const char *aName, uint32_t aStartMicros) {
+    printf("%s took %lu us simulated time\n", aName, (unsigned long) (hostMicros() - aStartMicros));
+}
+
+/*
+ * A started programmer without any pending output
+ */
+void startProgrammer() {
+    hostStart();
+    hostRunMillis(10);
+    hostClearOutput();
+    sResponseOffset = 0;
+}
+
+/*
+ * Send a text command and wait for the next output containing aResult
+ */
+bool runTextCommand(const char *aCommand, const char *aResult, uint32_t aTimeoutMillis) {
+    hostSendText(aCommand);
+    hostSendText("\r\n");
+    bool tFound = hostRunUntilOutput(aResult, aTimeoutMillis);
+    if (!tFound) {
+        printf("Output of \"%s\" is missing \"%s\":\n%s\n", aCommand, aResult, hostOutput());
+    }
+    return tFound;
+}
+
+uint32_t computeCRC32(const uint8_t *aData, size_t aLength) {
+    uint32_t tCRC = 0xFFFFFFFF;
+    for (size_t i = 0; i < aLength; ++i) {
+        tCRC ^= aData[i];
+        for (uint8_t tBit = 0; tBit < 8; ++tBit) {
+            tCRC = (tCRC >> 1) ^ (0xEDB88320 & -(tCRC & 1));
+        }
+    }
+    return ~tCRC;
+}
+
+void sendFrame(uint8_t aSequence, uint8_t aOpcode, const uint8_t *aPayload, uint8_t aLength, bool aCorruptCRC = false) {
+    uint8_t tFrame[FRAME_HEADER_SIZE + 255 + FRAME_CRC_SIZE] = { FRAME_SYNC, aSequence, aOpcode, aLength };
+    memcpy(&tFrame[FRAME_HEADER_SIZE], aPayload, aLength);
+    uint16_t tCRC = 0xFFFF;
+    for (uint16_t i = 1; i < FRAME_HEADER_SIZE + aLength; ++i) {
+        tCRC = _crc_ccitt_update(tCRC, tFrame[i]);
+    }
+    if (aCorruptCRC) {
+        tCRC ^= 0x0001;
+    }
+    tFrame[FRAME_HEADER_SIZE + aLength] = tCRC;
+    tFrame[FRAME_HEADER_SIZE + aLength + 1] = tCRC >> 8;
+    hostSend(tFrame, FRAME_HEADER_SIZE + aLength + FRAME_CRC_SIZE);
+}
+
+/*
+ * Wait for the next response frame and check its header and CRC
+ * @param aPayload receives the payload after the status byte
+ * @return status byte or -1 if no valid response arrived
+ */
+int receiveResponse(uint8_t aSequence, uint8_t aOpcode, uint8_t *aPayload, uint8_t *aLength) {
+    uint32_t tStartMillis = millis();
+    while (millis() - tStartMillis < 2000) {
+        hostRunLoop();
+        size_t tAvailable = hostOutputLength() - sResponseOffset;
+        const uint8_t *tFrame = (const uint8_t*) hostOutput() + sResponseOffset;
+        if (tAvailable < FRAME_HEADER_SIZE + 1 || tAvailable < (size_t) FRAME_HEADER_SIZE + tFrame[3] + FRAME_CRC_SIZE) {
+            continue;
+        }
+        uint8_t tLength = tFrame[3];
+        sResponseOffset += FRAME_HEADER_SIZE + tLength + FRAME_CRC_SIZE;
+        uint16_t tCRC = 0xFFFF;
+        for (uint16_t i = 1; i < FRAME_HEADER_SIZE + tLength; ++i) {
+            tCRC = _crc_ccitt_update(tCRC, tFrame[i]);
+        }
+        CHECK(tFrame[0] == FRAME_SYNC);
+        CHECK(tFrame[1] == aSequence);
+        CHECK(tFrame[2] == (aOpcode | OPCODE_RESPONSE));
+        CHECK(tFrame[FRAME_HEADER_SIZE + tLength] == (uint8_t) tCRC && tFrame[FRAME_HEADER_SIZE + tLength + 1] == (tCRC >> 8));
+        if (aPayload != NULL) {
+            memcpy(aPayload, &tFrame[FRAME_HEADER_SIZE + 1], tLength - 1);
+        }
+        if (aLength != NULL) {
+            *aLength = tLength - 1;
+        }
+        return tFrame[FRAME_HEADER_SIZE];
+    }
+    printf("No response for opcode 0x%02X\n", aOpcode);
+    return -1;
+}
+
+int runFrame(uint8_t aSequence, uint8_t aOpcode, const uint8_t *aPayload, uint8_t aLength, uint8_t *aResult = NULL,
+        uint8_t *aResultLength = NULL) {
+    sendFrame(aSequence, aOpcode, aPayload, aLength);
+    return receiveResponse(aSequence, aOpcode, aResult, aResultLength);
+}
+
+/*
+ * Wait for the end of the text output, then the next output is a response frame
+ */
+void startBinaryExchange() {
+    hostRunMillis(50);
+    sResponseOffset = hostOutputLength();
+}
+
+uint16_t readStatistic(uint16_t aOffset) {
+    startBinaryExchange();
+    uint8_t tStatistics[255];
+    uint8_t tLength = 0;
+    CHECK(runFrame(0x70, OPCODE_READ_STATISTICS, NULL, 0, tStatistics, &tLength) == STATUS_OK);
+    CHECK(tLength == STATISTICS_SIZE);
+    return tStatistics[aOffset] | (tStatistics[aOffset + 1] << 8);
+}
+
+/*
+ * Intel HEX records of 16 bytes, followed by the end of file record
+ */
+std::string createIntelHex(const uint8_t *aData, uint16_t aLength) {
+    std::string tText;
+    char tRecord[48];
+    for (uint16_t tAddress = 0; tAddress < aLength; tAddress += 16) {
+        uint8_t tLength = (aLength - tAddress < 16) ? aLength - tAddress : 16;
+        uint8_t tSum = tLength + (tAddress >> 8) + tAddress;
+        int tIndex = sprintf(tRecord, ":%02X%04X00", tLength, tAddress);
+        for (uint8_t i = 0; i < tLength; ++i) {
+            tIndex += sprintf(&tRecord[tIndex], "%02X", aData[tAddress + i]);
+            tSum += aData[tAddress + i];
+        }
+        sprintf(&tRecord[tIndex], "%02X\r\n", (uint8_t) -tSum);
+        tText += tRecord;
+    }
+    return tText + ":00000001FF\r\n";
+}
+
+/*
+ * Queue 'p' and the HEX text at full line rate, like extras/hvprog.py --text does for 64 byte pages.
+ * The sketch reads the stream inside loop(), so the whole stream is queued before.
+ */
+void sendHexText(const std::string &aHex) {
+    hostSendText("p\r\n");
+    hostSendAfterPause(HEX_PROMPT_WAIT_MILLIS * 1000UL, aHex.data(), aHex.size());
+}
+
+void setWrongFusesAndLock() {
+    sTarget.Fuses[TARGET_LFUSE_INDEX] = 0xE2;
+    sTarget.Fuses[TARGET_HFUSE_INDEX] = 0x5F; // RSTDISBL programmed
+    sTarget.LockBits = 0xFC;
+}
+
+void checkCleanHVSPTraffic() {
+    CHECK(sTarget.NumberOfBadEntries == 0);
+    CHECK(sTarget.NumberOfFramingErrors == 0);
+    CHECK(sTarget.NumberOfFramesWhileBusy == 0);
+    CHECK(hostNumberOfLostBytes() == 0);
+}
+
+/*
+ * Scenarios
+ */
+void testIdentify() {
+    initTargetModel(0x930B);
+    startProgrammer();
+    CHECK(runTextCommand("i", "Lock bits", 1000));
+    CHECK(strstr(hostOutput(), "The ATtiny is detected as ATtiny85.") != NULL);
+    CHECK(strstr(hostOutput(), "Signature: 1E930B Calibration: 5A 4C Fuses L:62 H:DF E:FF Lock bits: FF") != NULL);
+    checkCleanHVSPTraffic();
+}
+
+void testRestoreLockedPart() {
+    initTargetModel(0x930B);
+    setWrongFusesAndLock();
+    startProgrammer();
+    uint32_t tStartMicros = hostMicros();
+    CHECK(runTextCommand("e", "Fuse status L:W H:W E:=", 1000));
+    printSimulatedTime("Erase and fuse restore", tStartMicros);
+    CHECK(sTarget.Fuses[TARGET_LFUSE_INDEX] == 0x62 && sTarget.Fuses[TARGET_HFUSE_INDEX] == 0xDF);
+    CHECK(sTarget.LockBits == 0xFF);
+    CHECK(sTarget.NumberOfChipErases == 1 && sTarget.NumberOfFuseWrites == 2);
+    checkCleanHVSPTraffic();
+}
+
+void testWriteFusesOfLockedPart() {
+    initTargetModel(0x930B);
+    setWrongFusesAndLock();
+    startProgrammer();
+    CHECK(runTextCommand("f", "Fuse status L:X H:X E:W", 1000));
+    CHECK(sTarget.NumberOfLockedWrites == 3);
+    CHECK(readStatistic(STATISTICS_NUMBER_OF_FAILED_OFFSET) == 1);
+    checkCleanHVSPTraffic();
+}
+
+void testKeepEEPROM() {
+    initTargetModel(0x930B);
+    setWrongFusesAndLock();
+    for (uint16_t i = 0; i < sTarget.EEPROMSize; ++i) {
+        sTarget.EEPROM[i] = (i < sTarget.EEPROMSize / 2) ? i * 7 : 0xFF; // Blank pages of the upper half are not written
+    }
+    startProgrammer();
+    CHECK(runTextCommand("k", "Fuse status", 5000));
+    CHECK(strstr(hostOutput(), "EEPROM restored.") != NULL);
+    CHECK(strstr(hostOutput(), "Fuse status L:W H:W E:=") != NULL);
+    for (uint16_t i = 0; i < sTarget.EEPROMSize; ++i) {
+        CHECK(sTarget.EEPROM[i] == ((i < sTarget.EEPROMSize / 2) ? (uint8_t) (i * 7) : 0xFF));
+    }
+    CHECK(sTarget.NumberOfEEPROMPageWrites == sTarget.EEPROMSize / 2 / 4);
+    CHECK(sTarget.LockBits == 0xFF);
+    checkCleanHVSPTraffic();
+}
+
+void testNoDevice() {
+    initTargetModel(0x930B);
+    sTarget.IsInserted = false;
+    startProgrammer();
+    CHECK(runTextCommand("e", "No valid ATtiny signature detected!", 2000));
+    CHECK(readStatistic(STATISTICS_NUMBER_OF_CYCLES_OFFSET) == 1);
+    CHECK(readStatistic(STATISTICS_NUMBER_OF_FAILED_OFFSET) == 1);
+}
+
+void testSlowWriteTimeout() {
+    initTargetModel(0x930B);
+    setWrongFusesAndLock();
+    sTarget.WriteBusyMicros = 15000; // Longer than HVSP_READY_TIMEOUT_WRITE_MICROS
+    startProgrammer();
+    CHECK(runTextCommand("e", "Fuse status L:T", 1000));
+    CHECK(readStatistic(STATISTICS_WRITE_TIMEOUTS_OFFSET) == 1);
+    CHECK(sTarget.NumberOfFramingErrors == 0);
+}
+
+/*
+ * Stream a HEX file through 'p'
+ */
+void testProgramHexText() {
+    initTargetModel(0x930B);
+    startProgrammer();
+    uint8_t tImage[1000];
+    for (uint16_t i = 0; i < sizeof(tImage); ++i) {
+        tImage[i] = i ^ (i >> 8);
+    }
+    memset(&tImage[256], 0xFF, 64); // Blank page is skipped
+    std::string tHex = createIntelHex(tImage, sizeof(tImage));
+    sendHexText(tHex);
+    uint32_t tStartMicros = hostMicros();
+    CHECK(hostRunUntilOutput("blank pages skipped.", 5000));
+    printSimulatedTime("Erase and HEX stream of 1000 bytes", tStartMicros);
+    CHECK(strstr(hostOutput(), "Send Intel HEX file now.") != NULL);
+    CHECK(strstr(hostOutput(), "15 flash pages written, 1 blank pages skipped.") != NULL);
+    CHECK(memcmp(sTarget.Flash, tImage, sizeof(tImage)) == 0);
+    CHECK(sTarget.Flash[sizeof(tImage)] == 0xFF);
+    checkCleanHVSPTraffic();
+}
+
+/*
+ * A record with a byte count of 251, whose byte index would reach the value between records,
+ * must be rejected instead of being cut off without checksum check
+ */
+void testHexRecordTooLong() {
+    initTargetModel(0x930B);
+    startProgrammer();
+    uint8_t tData[251];
+    memset(tData, 0x55, sizeof(tData));
+    char tRecord[2 * (5 + sizeof(tData)) + 4];
+    int tIndex = sprintf(tRecord, ":%02X000000", (unsigned int) sizeof(tData));
+    uint8_t tSum = sizeof(tData);
+    for (uint16_t i = 0; i < sizeof(tData); ++i) {
+        tIndex += sprintf(&tRecord[tIndex], "%02X", tData[i]);
+        tSum += tData[i];
+    }
+    sprintf(&tRecord[tIndex], "%02X\r\n", (uint8_t) -tSum);
+    sendHexText(std::string(tRecord) + ":00000001FF\r\n");
+    CHECK(hostRunUntilOutput("Invalid Intel HEX data", 5000));
+    CHECK(strstr(hostOutput(), "flash pages written") == NULL);
+    CHECK(sTarget.NumberOfFlashPageWrites == 0);
+    checkCleanHVSPTraffic();
+}
+
+void testBinaryProtocol() {
+    initTargetModel(0x930B);
+    startProgrammer();
+    uint8_t tResult[255];
+    uint8_t tLength = 0;
+    CHECK(runFrame(1, OPCODE_GET_VERSION, NULL, 0, tResult, &tLength) == STATUS_OK);
+    CHECK(tLength == 4 && tResult[0] == 3);
+    uint8_t tMaxPayload = tResult[3];
+    CHECK(tMaxPayload >= 66);
+
+    CHECK(runFrame(2, OPCODE_POWER_UP, NULL, 0, tResult, &tLength) == STATUS_OK);
+    CHECK(tLength == 6 + 8 && tResult[0] == 0x0B && tResult[1] == 0x93); // Little endian
+    CHECK(tResult[2] == 0x00 && tResult[3] == 0x20 && tResult[4] == 64 && tResult[5] == 3); // 8192 bytes flash, 64 byte pages, 3 fuses
+    CHECK(memcmp(&tResult[6], "ATtiny85", 8) == 0);
+    CHECK(runFrame(3, OPCODE_CHIP_ERASE, NULL, 0) == STATUS_OK);
+
+    uint8_t tPage[2 + 64] = { 0x40, 0x00 }; // Second page
+    for (uint8_t i = 0; i < 64; ++i) {
+        tPage[2 + i] = 0xA0 + i;
+    }
+    CHECK(runFrame(4, OPCODE_WRITE_FLASH_PAGE, tPage, sizeof(tPage)) == STATUS_OK);
+    CHECK(memcmp(&sTarget.Flash[0x40], &tPage[2], 64) == 0);
+
+    uint32_t tCRC = computeCRC32(&tPage[2], 64);
+    uint8_t tVerify[] = { 0x40, 0x00, 64, 0x00, (uint8_t) tCRC, (uint8_t) (tCRC >> 8), (uint8_t) (tCRC >> 16), (uint8_t) (tCRC >> 24) };
+    CHECK(runFrame(5, OPCODE_VERIFY_FLASH, tVerify, sizeof(tVerify)) == STATUS_OK);
+
+    uint8_t tRead[] = { 0x48, 0x00, 16 };
+    CHECK(runFrame(6, OPCODE_READ_FLASH, tRead, sizeof(tRead), tResult, &tLength) == STATUS_OK);
+    CHECK(tLength == 16 && memcmp(tResult, &tPage[2 + 8], 16) == 0);
+
+    // A frame with wrong CRC is answered and the following frame is executed
+    sendFrame(7, OPCODE_READ_FUSES, NULL, 0, true);
+    CHECK(receiveResponse(7, OPCODE_READ_FUSES, NULL, NULL) == STATUS_CRC_ERROR);
+    CHECK(runFrame(8, OPCODE_READ_FUSES, NULL, 0, tResult, &tLength) == STATUS_OK);
+    CHECK(tLength == 3 && tResult[0] == 0x62 && tResult[1] == 0xDF && tResult[2] == 0xFF);
+    CHECK(runFrame(9, OPCODE_POWER_DOWN, NULL, 0) == STATUS_OK);
+    CHECK(!sTarget.IsInProgrammingMode);
+    checkCleanHVSPTraffic();
+}
+
+/*
+ * Send as many frames ahead as fit into the receive buffer, like extras/hvprog.py
+ */
+void testPipelinedFrames() {
+    initTargetModel(0x930B);
+    startProgrammer();
+    CHECK(runFrame(1, OPCODE_POWER_UP, NULL, 0) == STATUS_OK);
+    uint8_t tNumberOfFrames = RECEIVE_WINDOW_SIZE / (FRAME_HEADER_SIZE + FRAME_CRC_SIZE);
+    uint32_t tStartMicros = hostMicros();
+    for (uint8_t i = 0; i < tNumberOfFrames; ++i) {
+        sendFrame(10 + i, OPCODE_READ_FUSES, NULL, 0);
+    }
+    for (uint8_t i = 0; i < tNumberOfFrames; ++i) {
+        CHECK(receiveResponse(10 + i, OPCODE_READ_FUSES, NULL, NULL) == STATUS_OK);
+    }
+    printSimulatedTime("Pipelined read fuses requests", tStartMicros);
+    checkCleanHVSPTraffic();
+}
+
+/*
+ * Batch mode 'c' with one chip after the other
+ */
+void testBatch() {
+    const uint16_t tNumberOfChips = 20;
+    initTargetModel(0x930B);
+    sTarget.IsInserted = false;
+    startProgrammer();
+    CHECK(runTextCommand("c", "Batch mode started.", 1000));
+    clock_t tStartClock = clock();
+    uint32_t tStartMicros = hostMicros();
+    for (uint16_t tChip = 1; tChip <= tNumberOfChips; ++tChip) {
+        initTargetModel(0x930B);
+        setWrongFusesAndLock();
+        hostClearOutput();
+        CHECK(hostRunUntilOutput("PASS", 2000));
+        CHECK(sTarget.Fuses[TARGET_LFUSE_INDEX] == 0x62 && sTarget.Fuses[TARGET_HFUSE_INDEX] == 0xDF && sTarget.LockBits == 0xFF);
+        checkCleanHVSPTraffic();
+        sTarget.IsInserted = false;
+        CHECK(hostRunUntilOutput("Ready for next chip.", 2000));
+    }
+    printSimulatedTime("Batch of 20 chips", tStartMicros);
+    printf("Batch of 20 chips took %.3f s host time\n", (double) (clock() - tStartClock) / CLOCKS_PER_SEC);
+    CHECK(runTextCommand("x", "Batch mode stopped. Passed: 20 Failed: 0", 1000));
+}
+
+struct Scenario {
+    const char *Name;
+    void (*Function)();
+    bool IsTextUI;
+};
+
+const Scenario Scenarios[] = {
+        { "identify", &testIdentify, true },
+        { "restore_locked_part", &testRestoreLockedPart, true },
+        { "write_fuses_of_locked_part", &testWriteFusesOfLockedPart, true },
+        { "keep_eeprom", &testKeepEEPROM, true },
+        { "no_device", &testNoDevice, true },
+        { "slow_write_timeout", &testSlowWriteTimeout, true },
+        { "program_hex_text", &testProgramHexText, true },
+        { "hex_record_too_long", &testHexRecordTooLong, true },
+        { "batch", &testBatch, true },
+        { "binary_protocol", &testBinaryProtocol, false },
+        { "pipelined_frames", &testPipelinedFrames, false } };
+
+/*
+ * CRC of the binary host protocol by _crc_ccitt_update() of avr-libc, for comparison with extras/hvprog.py
+ */
+int printCRC16(const char *aHexBytes) {
+    uint16_t tCRC = 0xFFFF;
+    unsigned int tByte;
+    for (const char *tText = aHexBytes; sscanf(tText, "%2x", &tByte) == 1; tText += 2) {
+        tCRC = _crc_ccitt_update(tCRC, tByte);
+    }
+    printf("%04X\n", tCRC);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc == 2 && strcmp(argv[1], "serve") == 0) {
+        initTargetModel(0x930B);
+        return runSerialBridge() ? 0 : 1;
+    }
+    if (argc == 3 && strcmp(argv[1], "crc16") == 0) {
+        return printCRC16(argv[2]);
+    }
+    for (uint8_t i = 0; i < sizeof(Scenarios) / sizeof(Scenario); ++i) {
+        if (argc == 2 && strcmp(argv[1], Scenarios[i].Name) == 0) {
+#if defined(HVSP_MINIMAL)
+            if (Scenarios[i].IsTextUI) {
+                printf("Scenario %s requires the text UI\n", argv[1]);
+                return 1;
+            }
+#endif
+            Scenarios[i].Function();
+            printf("%s: %s\n", argv[1], sNumberOfFailedChecks == 0 ? "passed" : "FAILED");
+            return sNumberOfFailedChecks == 0 ? 0 : 1;
+        }
+    }
+    printf("Usage: %s <scenario> | serve | crc16 <hex bytes>\nScenarios:", argv[0]);
+    for (uint8_t i = 0; i < sizeof(Scenarios) / sizeof(Scenario); ++i) {
+        printf(" %s", Scenarios[i].Name);
+    }
+    printf("\n");
+    return 2;
+}
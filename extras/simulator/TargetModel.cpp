@@ -0,0 +1,299 @@
+/*
+ * TargetModel.cpp
+ *
+ * ATtiny model for the HVProgrammer simulator, see TargetModel.h
+ */
+#include <string.h>
+#include <Arduino.h>
+
+#include "HostCore.h"
+#include "TargetModel.h"
+
+TargetModel sTarget;
+
+struct TargetType {
+    uint16_t Signature;
+    uint16_t FlashSize;
+    uint8_t FlashPageSize;
+    uint16_t EEPROMSize;
+    uint8_t EEPROMPageSize;
+    uint8_t DefaultFuses[3];
+    uint8_t EESaveFuseIndex;
+    uint8_t EESaveMask;
+};
+
+// Values of the datasheets
+// Signature, flash size and page size, EEPROM size and page size, default fuses, location of EESAVE
+const TargetType TargetTypes[] = {
+        { 0x930B, 8192, 64, 512, 4, { 0x62, 0xDF, 0xFF }, TARGET_HFUSE_INDEX, 0x08 }, // ATtiny85
+        { 0x9206, 4096, 64, 256, 4, { 0x62, 0xDF, 0xFF }, TARGET_HFUSE_INDEX, 0x08 }, // ATtiny45
+        { 0x9108, 2048, 32, 128, 4, { 0x62, 0xDF, 0xFF }, TARGET_HFUSE_INDEX, 0x08 }, // ATtiny25
+        { 0x930C, 8192, 64, 512, 4, { 0x62, 0xDF, 0xFF }, TARGET_HFUSE_INDEX, 0x08 }, // ATtiny84
+        { 0x9007, 1024, 32, 64, 4, { 0x6A, 0xFF, 0xFF }, TARGET_LFUSE_INDEX, 0x40 } }; // ATtiny13
+
+void initTargetModel(uint16_t aSignature) {
+    const TargetType *tType = &TargetTypes[0];
+    for (uint8_t i = 0; i < sizeof(TargetTypes) / sizeof(TargetType); ++i) {
+        if (TargetTypes[i].Signature == aSignature) {
+            tType = &TargetTypes[i];
+        }
+    }
+    memset(&sTarget, 0, sizeof(sTarget));
+    sTarget.IsInserted = true;
+    sTarget.Signature[0] = 0x1E;
+    sTarget.Signature[1] = aSignature >> 8;
+    sTarget.Signature[2] = aSignature;
+    sTarget.Calibration[0] = 0x5A;
+    sTarget.Calibration[1] = 0x4C;
+    memcpy(sTarget.Fuses, tType->DefaultFuses, sizeof(sTarget.Fuses));
+    sTarget.LockBits = 0xFF;
+    sTarget.EESaveFuseIndex = tType->EESaveFuseIndex;
+    sTarget.EESaveMask = tType->EESaveMask;
+    sTarget.FlashSize = tType->FlashSize;
+    sTarget.FlashPageSize = tType->FlashPageSize;
+    sTarget.EEPROMSize = tType->EEPROMSize;
+    sTarget.EEPROMPageSize = tType->EEPROMPageSize;
+    sTarget.WriteBusyMicros = 4500; // tWD_FUSE and tWD_FLASH
+    sTarget.EraseBusyMicros = 9000; // tWD_ERASE
+    memset(sTarget.Flash, 0xFF, sizeof(sTarget.Flash));
+    memset(sTarget.EEPROM, 0xFF, sizeof(sTarget.EEPROM));
+}
+
+bool isTargetLocked() {
+    return (sTarget.LockBits & 0x03) != 0x03;
+}
+
+static bool isTargetBusy() {
+    return hostCycles() < sTarget.BusyUntilCycles;
+}
+
+static void startBusy(uint32_t aMicros) {
+    sTarget.BusyUntilCycles = hostCycles() + (uint64_t) aMicros * HOST_CYCLES_PER_MICROSECOND;
+}
+
+static void enterProgrammingMode() {
+    /*
+     * Prog_enable pattern: SDI, SII and SDO low while 12 V is applied
+     */
+    if (hostPinLevel(TARGET_PIN_SDI) != LOW || hostPinLevel(TARGET_PIN_SII) != LOW || !hostIsPinOutput(TARGET_PIN_SDO)
+            || hostPinLevel(TARGET_PIN_SDO) != LOW) {
+        sTarget.NumberOfBadEntries++;
+        return;
+    }
+    sTarget.NumberOfEntries++;
+    sTarget.IsInProgrammingMode = true;
+    sTarget.BitCount = 0;
+    sTarget.OutputByte = 0;
+    sTarget.LastControl = CONTROL_WR | CONTROL_OE;
+    sTarget.Command = 0;
+    sTarget.BusyUntilCycles = 0;
+    memset(sTarget.FlashPageBuffer, 0xFF, sizeof(sTarget.FlashPageBuffer));
+    sTarget.EEPROMPageBufferLoadedMask = 0;
+}
+
+static uint16_t getAddress() {
+    return ((uint16_t) sTarget.AddressHigh << 8) | sTarget.AddressLow;
+}
+
+/*
+ * PAGEL pulse, latch the data byte into the page buffer
+ */
+static void latchPageBuffer(bool aBS1) {
+    if (sTarget.Command == TARGET_COMMAND_WRITE_FLASH) {
+        uint8_t tWordIndex = sTarget.AddressLow & (sTarget.FlashPageSize / 2 - 1);
+        if (aBS1) {
+            sTarget.FlashPageBuffer[tWordIndex * 2 + 1] = sTarget.DataHigh;
+        } else {
+            sTarget.FlashPageBuffer[tWordIndex * 2] = sTarget.DataLow;
+        }
+    } else if (sTarget.Command == TARGET_COMMAND_WRITE_EEPROM) {
+        uint8_t tIndex = sTarget.AddressLow & (sTarget.EEPROMPageSize - 1);
+        sTarget.EEPROMPageBuffer[tIndex] = sTarget.DataLow;
+        sTarget.EEPROMPageBufferLoadedMask |= 1 << tIndex;
+    }
+}
+
+/*
+ * End of the negative pulse of WR, start the write or erase of the loaded command with BS1 and BS2 of the pulse
+ */
+static void startWrite(bool aBS1, bool aBS2) {
+    switch (sTarget.Command) {
+    case TARGET_COMMAND_CHIP_ERASE:
+        sTarget.NumberOfChipErases++;
+        memset(sTarget.Flash, 0xFF, sizeof(sTarget.Flash));
+        if (sTarget.Fuses[sTarget.EESaveFuseIndex] & sTarget.EESaveMask) {
+            memset(sTarget.EEPROM, 0xFF, sizeof(sTarget.EEPROM));
+        }
+        sTarget.LockBits = 0xFF;
+        startBusy(sTarget.EraseBusyMicros);
+        return;
+
+    case TARGET_COMMAND_WRITE_FUSE:
+    case TARGET_COMMAND_WRITE_LOCK_BITS:
+    case TARGET_COMMAND_WRITE_FLASH:
+    case TARGET_COMMAND_WRITE_EEPROM:
+        break;
+
+    default:
+        return;
+    }
+
+    startBusy(sTarget.WriteBusyMicros);
+    if (sTarget.Command != TARGET_COMMAND_WRITE_LOCK_BITS && isTargetLocked()) {
+        sTarget.NumberOfLockedWrites++;
+        return;
+    }
+    if (sTarget.Command == TARGET_COMMAND_WRITE_FUSE) {
+        sTarget.NumberOfFuseWrites++;
+        sTarget.Fuses[aBS1 ? TARGET_HFUSE_INDEX : (aBS2 ? TARGET_EFUSE_INDEX : TARGET_LFUSE_INDEX)] = sTarget.DataLow;
+
+    } else if (sTarget.Command == TARGET_COMMAND_WRITE_LOCK_BITS) {
+        sTarget.LockBits &= sTarget.DataLow | 0xFC; // Lock bits can only be programmed, chip erase clears them
+
+    } else if (sTarget.Command == TARGET_COMMAND_WRITE_FLASH) {
+        sTarget.NumberOfFlashPageWrites++;
+        uint32_t tPageAddress = ((uint32_t) getAddress() * 2) & ~(uint32_t) (sTarget.FlashPageSize - 1);
+        if (tPageAddress < sTarget.FlashSize) {
+            for (uint8_t i = 0; i < sTarget.FlashPageSize; ++i) {
+                sTarget.Flash[tPageAddress + i] &= sTarget.FlashPageBuffer[i]; // Programming can only clear bits
+            }
+        }
+        memset(sTarget.FlashPageBuffer, 0xFF, sizeof(sTarget.FlashPageBuffer));
+
+    } else {
+        sTarget.NumberOfEEPROMPageWrites++;
+        uint16_t tPageAddress = getAddress() & ~(sTarget.EEPROMPageSize - 1);
+        for (uint8_t i = 0; i < sTarget.EEPROMPageSize; ++i) {
+            if ((sTarget.EEPROMPageBufferLoadedMask & (1 << i)) && tPageAddress + i < sTarget.EEPROMSize) {
+                sTarget.EEPROM[tPageAddress + i] = sTarget.EEPROMPageBuffer[i]; // Atomic erase and write of the loaded bytes
+            }
+        }
+        sTarget.EEPROMPageBufferLoadedMask = 0;
+    }
+}
+
+/*
+ * OE active, put the addressed byte on the data bus
+ */
+static uint8_t readDataBus(bool aBS1, bool aBS2) {
+    switch (sTarget.Command) {
+    case TARGET_COMMAND_READ_SIGNATURE:
+        if (aBS1) {
+            return sTarget.Calibration[sTarget.AddressLow & 0x01];
+        }
+        return (sTarget.AddressLow < 3) ? sTarget.Signature[sTarget.AddressLow] : 0xFF;
+    case TARGET_COMMAND_READ_FUSES:
+        if (aBS1) {
+            return aBS2 ? sTarget.Fuses[TARGET_HFUSE_INDEX] : sTarget.LockBits;
+        }
+        return aBS2 ? sTarget.Fuses[TARGET_EFUSE_INDEX] : sTarget.Fuses[TARGET_LFUSE_INDEX];
+    case TARGET_COMMAND_READ_FLASH:
+        return sTarget.Flash[((uint32_t) getAddress() * 2 + (aBS1 ? 1 : 0)) % sTarget.FlashSize];
+    case TARGET_COMMAND_READ_EEPROM:
+        return sTarget.EEPROM[getAddress() % sTarget.EEPROMSize];
+    default:
+        return 0;
+    }
+}
+
+static void executeFrame() {
+    sTarget.NumberOfFrames++;
+    if ((sTarget.SDIBits | sTarget.SIIBits) & 0x403) {
+        sTarget.NumberOfFramingErrors++;
+    }
+    if (sTarget.IsFrameWhileBusy) {
+        return;
+    }
+    uint8_t tData = sTarget.SDIBits >> 2;
+    uint8_t tControl = sTarget.SIIBits >> 2;
+    bool tBS1 = tControl & CONTROL_BS1;
+    bool tBS2 = tControl & CONTROL_BS2;
+
+    // XTAL1 pulse of the frame loads the data bus into the register selected by XA1, XA0 and BS1
+    switch (tControl & (CONTROL_XA1 | CONTROL_XA0)) {
+    case 0:
+        if (tBS1) {
+            sTarget.AddressHigh = tData;
+        } else {
+            sTarget.AddressLow = tData;
+        }
+        break;
+    case CONTROL_XA0:
+        if (tBS1) {
+            sTarget.DataHigh = tData;
+        } else {
+            sTarget.DataLow = tData;
+        }
+        break;
+    case CONTROL_XA1:
+        sTarget.Command = tData;
+        break;
+    default:
+        break; // No action
+    }
+
+    if ((tControl & CONTROL_PAGEL) && !(sTarget.LastControl & CONTROL_PAGEL)) {
+        latchPageBuffer(tBS1);
+    }
+    if ((tControl & CONTROL_WR) && !(sTarget.LastControl & CONTROL_WR)) {
+        startWrite(sTarget.LastControl & CONTROL_BS1, sTarget.LastControl & CONTROL_BS2);
+    }
+    if (!(tControl & CONTROL_OE)) {
+        sTarget.OutputByte = readDataBus(tBS1, tBS2);
+    }
+    sTarget.LastControl = tControl;
+}
+
+void targetPinChanged(uint8_t aPin, uint8_t aLevel) {
+    if (!sTarget.IsInserted) {
+        return;
+    }
+    if (aPin == TARGET_PIN_VCC) {
+        sTarget.IsPowered = (aLevel == HIGH);
+        if (!sTarget.IsPowered) {
+            sTarget.IsInProgrammingMode = false;
+        }
+
+    } else if (aPin == TARGET_PIN_RST) {
+        if (aLevel == HIGH) {
+            sTarget.IsInProgrammingMode = false; // 12 V off
+        } else if (sTarget.IsPowered && !sTarget.IsInProgrammingMode) {
+            enterProgrammingMode();
+        }
+
+    } else if (aPin == TARGET_PIN_SCI && aLevel == HIGH && sTarget.IsInProgrammingMode) {
+        if (sTarget.BitCount == 0) {
+            sTarget.IsFrameWhileBusy = isTargetBusy();
+            if (sTarget.IsFrameWhileBusy) {
+                sTarget.NumberOfFramesWhileBusy++;
+            }
+            sTarget.ShiftByte = sTarget.OutputByte;
+            sTarget.OutputByte = 0;
+            sTarget.SDIBits = 0;
+            sTarget.SIIBits = 0;
+        }
+        sTarget.SDIBits = (sTarget.SDIBits << 1) | (hostPinLevel(TARGET_PIN_SDI) == HIGH);
+        sTarget.SIIBits = (sTarget.SIIBits << 1) | (hostPinLevel(TARGET_PIN_SII) == HIGH);
+        if (++sTarget.BitCount == 11) {
+            sTarget.BitCount = 0;
+            executeFrame();
+        }
+    }
+}
+
+/*
+ * After the rising edge of bit n of a frame, the part outputs bit 7 - n of the byte read by the previous frame.
+ * Outside of a frame SDO is RDY/BSY.
+ */
+uint8_t targetSDOLevel() {
+    if (!sTarget.IsInserted || !sTarget.IsInProgrammingMode) {
+        return LOW; // Pull down of the fixture
+    }
+    if (sTarget.BitCount == 0) {
+        return isTargetBusy() ? LOW : HIGH;
+    }
+    if (sTarget.BitCount <= 8) {
+        return (sTarget.ShiftByte >> (8 - sTarget.BitCount)) & 0x01;
+    }
+    return LOW;
+}
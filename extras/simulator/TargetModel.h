@@ -0,0 +1,126 @@
+/*
+ * TargetModel.h
+ *
+ * Model of an ATtiny in high voltage serial programming mode, connected to the simulated pins of the programmer.
+ * The model latches SDI and SII at each rising edge of SCI and decodes each 11 bit frame like the part does:
+ * The instruction byte on SII gives the levels of the control lines of the parallel programming interface,
+ * XA1, XA0, BS1, WR, OE, BS2 and PAGEL from bit 6 to bit 0, and the byte on SDI is the value on the data bus.
+ * So the model executes all sequences built from the frames of the datasheet, not only the ones the sketch uses today.
+ * The byte read by a frame with OE active is shifted out on SDO by the next frame.
+ * A write or erase starts at the end of the negative pulse of WR. Then SDO stays low for the busy time, which is configurable,
+ * and a frame sent before SDO signals ready is counted and ignored.
+ */
+#ifndef TARGET_MODEL_H_
+#define TARGET_MODEL_H_
+
+#include <stdint.h>
+
+// Pins of the programmer, see HVProgrammer.cpp
+#define TARGET_PIN_VCC 2
+#define TARGET_PIN_SDI 3
+#define TARGET_PIN_SII 4
+#define TARGET_PIN_SDO 5
+#define TARGET_PIN_RST 18 // A4, LOW switches 12 V on
+#define TARGET_PIN_SCI 19 // A5
+
+#define TARGET_MAX_FLASH_SIZE 8192
+#define TARGET_MAX_FLASH_PAGE_SIZE 64
+#define TARGET_MAX_EEPROM_SIZE 512
+#define TARGET_MAX_EEPROM_PAGE_SIZE 4
+
+// Levels of the control lines in the instruction byte on SII
+#define CONTROL_XA1 0x40
+#define CONTROL_XA0 0x20
+#define CONTROL_BS1 0x10
+#define CONTROL_WR 0x08 // 0 is active
+#define CONTROL_OE 0x04 // 0 is active
+#define CONTROL_BS2 0x02
+#define CONTROL_PAGEL 0x01
+
+// Commands loaded with XA1 high and XA0 low
+#define TARGET_COMMAND_CHIP_ERASE 0x80
+#define TARGET_COMMAND_WRITE_FUSE 0x40
+#define TARGET_COMMAND_WRITE_LOCK_BITS 0x20
+#define TARGET_COMMAND_WRITE_FLASH 0x10
+#define TARGET_COMMAND_WRITE_EEPROM 0x11
+#define TARGET_COMMAND_READ_SIGNATURE 0x08
+#define TARGET_COMMAND_READ_FUSES 0x04
+#define TARGET_COMMAND_READ_FLASH 0x02
+#define TARGET_COMMAND_READ_EEPROM 0x03
+
+#define TARGET_LFUSE_INDEX 0
+#define TARGET_HFUSE_INDEX 1
+#define TARGET_EFUSE_INDEX 2
+
+struct TargetModel {
+    /*
+     * Configuration, set by initTargetModel() and changed by the test
+     */
+    bool IsInserted;
+    uint8_t Signature[3];
+    uint8_t Calibration[2];
+    uint8_t Fuses[3];
+    uint8_t LockBits; // An other value than 0xFF for bit 0 and 1 locks fuses, flash and EEPROM against writing
+    uint8_t EESaveFuseIndex; // Fuse with the EESAVE bit, which preserves the EEPROM at chip erase if programmed (0)
+    uint8_t EESaveMask;
+    uint16_t FlashSize;
+    uint8_t FlashPageSize; // In bytes
+    uint16_t EEPROMSize;
+    uint8_t EEPROMPageSize;
+    uint32_t WriteBusyMicros; // Fuse, lock bits, flash page and EEPROM
+    uint32_t EraseBusyMicros;
+    uint8_t Flash[TARGET_MAX_FLASH_SIZE];
+    uint8_t EEPROM[TARGET_MAX_EEPROM_SIZE];
+
+    /*
+     * Counters for the checks of the tests
+     */
+    uint32_t NumberOfEntries; // Into HV programming mode
+    uint32_t NumberOfBadEntries; // 12 V applied without SDI, SII and SDO low
+    uint32_t NumberOfFrames;
+    uint32_t NumberOfFramingErrors; // Start or stop bits which are not 0
+    uint32_t NumberOfFramesWhileBusy; // Ignored by the part
+    uint32_t NumberOfLockedWrites; // Ignored by the part
+    uint32_t NumberOfChipErases;
+    uint32_t NumberOfFuseWrites;
+    uint32_t NumberOfFlashPageWrites;
+    uint32_t NumberOfEEPROMPageWrites;
+
+    /*
+     * State of the HVSP interface
+     */
+    bool IsPowered;
+    bool IsInProgrammingMode;
+    uint8_t BitCount; // Rising edges of SCI in the current frame
+    uint16_t SDIBits;
+    uint16_t SIIBits;
+    bool IsFrameWhileBusy;
+    uint8_t OutputByte; // Read by the last frame with OE active, shifted out by the next frame
+    uint8_t ShiftByte;
+    uint8_t LastControl;
+    uint8_t Command;
+    uint8_t AddressLow;
+    uint8_t AddressHigh;
+    uint8_t DataLow;
+    uint8_t DataHigh;
+    uint8_t FlashPageBuffer[TARGET_MAX_FLASH_PAGE_SIZE];
+    uint8_t EEPROMPageBuffer[TARGET_MAX_EEPROM_PAGE_SIZE];
+    uint8_t EEPROMPageBufferLoadedMask;
+    uint64_t BusyUntilCycles;
+};
+extern TargetModel sTarget;
+
+/*
+ * Inserted erased part with the default fuses, if aSignature is not known, the memory sizes of an ATtiny85 are used
+ * @param aSignature signature byte 1 and 2, e.g. 0x930B for an ATtiny85
+ */
+void initTargetModel(uint16_t aSignature);
+bool isTargetLocked();
+
+/*
+ * Called by the host core for each change of a programmer line
+ */
+void targetPinChanged(uint8_t aPin, uint8_t aLevel);
+uint8_t targetSDOLevel();
+
+#endif // TARGET_MODEL_H_
@@ -0,0 +1,112 @@
+/*
+ * Arduino.h
+ *
+ * Host replacement of the Arduino core for the HVProgrammer simulator.
+ * Only the functions used by HVProgrammer.cpp are provided. They run on the simulated clock of HostCore.cpp,
+ * which counts the CPU cycles of a 16 MHz ATmega328P, so the timing of the sketch is that of a Nano and not that of the host.
+ * The types of millis() and micros() have the 32 bit width of the AVR, so their overflow behaves as on the target.
+ */
+#ifndef ARDUINO_H_
+#define ARDUINO_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define F_CPU 16000000UL
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define DEC 10
+#define HEX 16
+#define BIN 2
+
+#define _BV(aBit) (1 << (aBit))
+
+// Pin numbers of the Nano
+#define LED_BUILTIN 13
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+#define A6 20
+#define A7 21
+#define NUMBER_OF_PINS 22
+
+void pinMode(uint8_t aPin, uint8_t aMode);
+void digitalWrite(uint8_t aPin, uint8_t aValue);
+int digitalRead(uint8_t aPin);
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t aMillis);
+void delayMicroseconds(unsigned int aMicros);
+
+void noInterrupts();
+void interrupts();
+
+/*
+ * The cycle delay of avr-gcc, advances the simulated clock
+ */
+void hostDelayCycles(uint32_t aCycles);
+#define __builtin_avr_delay_cycles(aCycles) hostDelayCycles(aCycles)
+
+class __FlashStringHelper;
+#define F(aString) (reinterpret_cast<const __FlashStringHelper *>(PSTR(aString)))
+
+/*
+ * Received bytes are put into a ring buffer of SERIAL_RX_BUFFER_SIZE bytes at the time they arrive at the baud rate,
+ * which holds one byte less than its size, like the one of HardwareSerial. Bytes arriving at a full buffer are dropped and counted.
+ * Each sent byte takes its time at the baud rate, a write to a full transmit buffer waits for a free place.
+ */
+#define SERIAL_RX_BUFFER_SIZE 64
+#define SERIAL_TX_BUFFER_SIZE 64
+
+class HardwareSerial {
+public:
+    void begin(uint32_t aBaudrate);
+    operator bool() {
+        return true;
+    }
+    int available();
+    int peek();
+    int read();
+    size_t write(uint8_t aByte);
+    size_t write(const uint8_t *aBuffer, size_t aLength);
+
+    size_t print(const __FlashStringHelper *aText);
+    size_t print(const char *aText);
+    size_t print(char aCharacter);
+    size_t print(unsigned char aValue, int aBase = DEC);
+    size_t print(int aValue, int aBase = DEC);
+    size_t print(unsigned int aValue, int aBase = DEC);
+    size_t print(long aValue, int aBase = DEC);
+    size_t print(unsigned long aValue, int aBase = DEC);
+
+    size_t println();
+    template<typename T> size_t println(T aValue) {
+        size_t tLength = print(aValue);
+        return tLength + println();
+    }
+    template<typename T> size_t println(T aValue, int aBase) {
+        size_t tLength = print(aValue, aBase);
+        return tLength + println();
+    }
+
+private:
+    size_t printNumber(unsigned long aValue, int aBase);
+};
+extern HardwareSerial Serial;
+
+#endif // ARDUINO_H_
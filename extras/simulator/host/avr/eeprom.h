@@ -0,0 +1,37 @@
+/*
+ * eeprom.h
+ *
+ * Host replacement of <avr/eeprom.h>.
+ * EEMEM variables are placed in the section host_eeprom of the host RAM, which hostEraseEEPROM() fills with 0xFF
+ * like the erased EEPROM of a new Nano. The content lasts as long as the simulator process.
+ */
+#ifndef EEPROM_H_
+#define EEPROM_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#define EEMEM __attribute__((section("host_eeprom")))
+
+inline uint8_t eeprom_read_byte(const uint8_t *aAddress) {
+    return *aAddress;
+}
+inline uint16_t eeprom_read_word(const uint16_t *aAddress) {
+    uint16_t tValue;
+    memcpy(&tValue, aAddress, sizeof(tValue));
+    return tValue;
+}
+inline void eeprom_read_block(void *aDestination, const void *aSource, size_t aLength) {
+    memcpy(aDestination, aSource, aLength);
+}
+inline void eeprom_update_byte(uint8_t *aAddress, uint8_t aValue) {
+    *aAddress = aValue;
+}
+inline void eeprom_update_word(uint16_t *aAddress, uint16_t aValue) {
+    memcpy(aAddress, &aValue, sizeof(aValue));
+}
+inline void eeprom_update_block(const void *aSource, void *aDestination, size_t aLength) {
+    memcpy(aDestination, aSource, aLength);
+}
+
+#endif // EEPROM_H_
@@ -0,0 +1,24 @@
+/*
+ * pgmspace.h
+ *
+ * Host replacement of <avr/pgmspace.h>. Host flash and RAM share one address space, so PROGMEM data is read directly.
+ */
+#ifndef PGMSPACE_H_
+#define PGMSPACE_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(aString) (aString)
+
+#define pgm_read_byte(aAddress) (*(const uint8_t *) (aAddress))
+#define pgm_read_word(aAddress) (*(const uint16_t *) (aAddress))
+#define pgm_read_dword(aAddress) (*(const uint32_t *) (aAddress))
+#define pgm_read_ptr(aAddress) (*(void * const *) (aAddress))
+#define memcpy_P memcpy
+#define strlen_P strlen
+#define strcpy_P strcpy
+
+#endif // PGMSPACE_H_
@@ -0,0 +1,12 @@
+/*
+ * wdt.h
+ *
+ * Host replacement of <avr/wdt.h>. The simulator has no watchdog, HV_WATCHDOG is not defined for a host build.
+ */
+#ifndef WDT_H_
+#define WDT_H_
+
+#define wdt_reset()
+#define wdt_disable()
+
+#endif // WDT_H_
@@ -0,0 +1,17 @@
+/*
+ * crc16.h
+ *
+ * Host replacement of <util/crc16.h>, the C equivalent from the avr-libc documentation
+ */
+#ifndef CRC16_H_
+#define CRC16_H_
+
+#include <stdint.h>
+
+inline uint16_t _crc_ccitt_update(uint16_t aCRC, uint8_t aData) {
+    aData ^= (uint8_t) aCRC;
+    aData ^= aData << 4;
+    return ((((uint16_t) aData << 8) | (aCRC >> 8)) ^ (uint8_t) (aData >> 4) ^ ((uint16_t) aData << 3));
+}
+
+#endif // CRC16_H_
@@ -0,0 +1,17 @@
+/*
+ * delay_basic.h
+ *
+ * Host replacement of <util/delay_basic.h>. The loop takes 3 cycles per count, a count of 0 is 256 loops.
+ */
+#ifndef DELAY_BASIC_H_
+#define DELAY_BASIC_H_
+
+#include <stdint.h>
+
+void hostDelayCycles(uint32_t aCycles);
+
+inline void _delay_loop_1(uint8_t aCount) {
+    hostDelayCycles(3 * (aCount == 0 ? 256 : aCount));
+}
+
+#endif // DELAY_BASIC_H_
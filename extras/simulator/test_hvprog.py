@@ -0,0 +1,236 @@
+#!/usr/bin/env python3
+"""
+Tests of extras/hvprog.py, see "Host simulator" in README.md.
+
+The unit tests check CRC, Intel HEX parsing, page splitting, text pacing and the window accounting of the pipeline.
+With the path of the simulator as argument, hvprog.py is also run against the simulated programmer with an ATtiny85 at a pty.
+
+  test_hvprog.py [build/HVProgrammerSimulator]
+
+Requires pyserial.
+"""
+import collections
+import os
+import random
+import subprocess
+import sys
+import tempfile
+import unittest
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+import hvprog  # noqa: E402
+
+HVPROG = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "hvprog.py")
+SIMULATOR = None  # Set by main()
+
+
+def create_intel_hex(data, address=0):
+    """Records of 16 bytes, followed by the end of file record"""
+    lines = []
+    for start in range(0, len(data), 16):
+        record = bytes((min(16, len(data) - start), (address + start) >> 8, (address + start) & 0xFF, 0x00)) + data[start:start + 16]
+        lines.append(":" + (record + bytes((-sum(record) & 0xFF,))).hex().upper())
+    return "\n".join(lines + [":00000001FF"]) + "\n"
+
+
+def write_temporary_file(text):
+    file = tempfile.NamedTemporaryFile("w", suffix=".hex", delete=False)
+    file.write(text)
+    file.close()
+    return file.name
+
+
+class FakeSerial:
+    """Programmer which answers one request each time the tool reads, and records the request bytes waiting in its receive buffer"""
+
+    def __init__(self):
+        self.baudrate = 115200
+        self.pending = collections.deque()  # Request frames not yet answered, the first one is executed
+        self.output = bytearray()
+        self.max_waiting = 0  # Of the bytes behind the executed request
+
+    def write(self, data):
+        self.pending.append(bytes(data))
+        self.max_waiting = max(self.max_waiting, sum(len(frame) for frame in list(self.pending)[1:]))
+
+    def read(self, size):
+        if not self.output and self.pending:
+            request = self.pending.popleft()
+            data = bytes(3) if request[2] == hvprog.OPCODE_READ_FUSES else b""
+            frame = bytes((request[1], request[2] | hvprog.OPCODE_RESPONSE, 1 + len(data), hvprog.STATUS_OK)) + data
+            crc = hvprog.crc16(frame)
+            self.output += bytes((hvprog.FRAME_SYNC,)) + frame + bytes((crc & 0xFF, crc >> 8))
+        data = bytes(self.output[:size])
+        del self.output[:size]
+        return data
+
+    @property
+    def in_waiting(self):
+        return len(self.output)
+
+
+def create_fake_programmer(max_payload=66):
+    programmer = hvprog.Programmer.__new__(hvprog.Programmer)
+    programmer.port = "fake"
+    programmer.window = hvprog.DEFAULT_WINDOW
+    programmer.timeout = 1.0
+    programmer.serial = FakeSerial()
+    programmer.sequence = 0
+    programmer.in_flight = collections.deque()
+    programmer.rx = bytearray()
+    programmer._completed = collections.deque()
+    programmer.max_payload = max_payload
+    return programmer
+
+
+class UnitTest(unittest.TestCase):
+    def test_crc16_check_value(self):
+        self.assertEqual(hvprog.crc16(b"123456789"), 0x6F91)  # Check value of CRC-16/MCRF4XX
+
+    def test_crc16_against_sketch(self):
+        if SIMULATOR is None:
+            self.skipTest("no simulator given")
+        generator = random.Random(1)
+        for length in (0, 1, 5, 70, 255):
+            data = bytes(generator.randrange(256) for _ in range(length))
+            output = subprocess.run([SIMULATOR, "crc16", data.hex()], stdout=subprocess.PIPE, check=True).stdout
+            self.assertEqual(int(output, 16), hvprog.crc16(data), "length %d" % length)
+
+    def test_read_intel_hex(self):
+        text = create_intel_hex(bytes(range(20)), 0x0100)
+        text = ":020000020010EC\n" + text + ":0100000055AA\n"  # Segment 0x10 adds 0x100, record behind end of file is ignored
+        name = write_temporary_file(text)
+        try:
+            memory = hvprog.read_intel_hex(name)
+        finally:
+            os.unlink(name)
+        self.assertEqual(memory, {0x200 + i: i for i in range(20)})
+
+    def test_read_intel_hex_errors(self):
+        for text in (":0100000055AB\n", "0100000055AA\n", ":01000000\n"):
+            name = write_temporary_file(text)
+            try:
+                with self.assertRaises(ValueError, msg=text):
+                    hvprog.read_intel_hex(name)
+            finally:
+                os.unlink(name)
+
+    def test_split_pages(self):
+        pages = hvprog.split_pages({0x00: 0x11, 0x41: 0x22, 0x7F: 0x33}, 64, 8192)
+        self.assertEqual(sorted(pages), [0x00, 0x40])
+        self.assertEqual(pages[0x00], b"\x11" + b"\xFF" * 63)
+        self.assertEqual(pages[0x40], b"\xFF\x22" + b"\xFF" * 61 + b"\x33")
+        with self.assertRaises(ValueError):
+            hvprog.split_pages({8192: 0}, 64, 8192)
+
+    def test_text_page_pauses(self):
+        lines = create_intel_hex(bytes(512)).splitlines()
+        text, pauses = hvprog.text_page_pauses(lines, 64, 115200)
+        self.assertEqual(text, "".join(line + "\r\n" for line in lines).encode("ascii"))
+        self.assertEqual(pauses, [])  # A page of text takes longer than a page write
+        text, pauses = hvprog.text_page_pauses(lines, 32, 115200)
+        self.assertEqual(len(pauses), 512 // 32 - 1)
+        # The first byte of each page is the first data byte of a record
+        self.assertEqual([offset for offset, _ in pauses], [index + 9 for index in range(90, len(text) - 13, 90)])
+        for _, seconds in pauses:
+            self.assertAlmostEqual(seconds, hvprog.TEXT_PAGE_WRITE_SECONDS - 90 * 10 / 115200)
+
+    def test_window_of_pipelined_requests(self):
+        programmer = create_fake_programmer()
+        responses = list(programmer.pipeline([(hvprog.OPCODE_READ_FUSES, b"")] * 40))
+        self.assertEqual(len(responses), 40)
+        self.assertLessEqual(programmer.serial.max_waiting, hvprog.DEFAULT_WINDOW)
+        self.assertGreater(programmer.serial.max_waiting, hvprog.DEFAULT_WINDOW - 6)  # Window is used
+
+    def test_window_of_verify_pages(self):
+        for max_payload in (66, 255):
+            programmer = create_fake_programmer(max_payload)
+            pages = {address: bytes(64) for address in range(0, 8192, 64)}
+            self.assertTrue(programmer.verify_pages(pages, 64, 8192))
+            self.assertLessEqual(programmer.serial.max_waiting, hvprog.DEFAULT_WINDOW)
+            self.assertGreater(programmer.serial.max_waiting, 0, "verify frames are pipelined")
+
+    def test_parse_frame_resynchronizes(self):
+        programmer = create_fake_programmer()
+        frame = bytes((7, hvprog.OPCODE_READ_FUSES | hvprog.OPCODE_RESPONSE, 4, 0, 0x62, 0xDF, 0xFF))
+        crc = hvprog.crc16(frame)
+        valid = bytes((hvprog.FRAME_SYNC,)) + frame + bytes((crc & 0xFF, crc >> 8))
+        corrupted = bytearray(valid)
+        corrupted[5] ^= 1
+        programmer.rx = bytearray(b"Watchdog timeout in state 3\r\n") + corrupted + valid
+        self.assertEqual(programmer._parse_frame(), (7, hvprog.OPCODE_READ_FUSES, 0, b"\x62\xDF\xFF"))
+        self.assertEqual(programmer.rx, b"")
+
+
+class SimulatorTest(unittest.TestCase):
+    """hvprog.py against the simulated programmer. Each run of the tool waits about 3 s for the start text."""
+
+    @classmethod
+    def setUpClass(cls):
+        if SIMULATOR is None:
+            raise unittest.SkipTest("no simulator given")
+        cls.process = subprocess.Popen([SIMULATOR, "serve"], stdout=subprocess.PIPE)
+        cls.port = cls.process.stdout.readline().decode().strip()
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.process.terminate()
+        cls.process.wait()
+
+    def run_tool(self, *arguments):
+        result = subprocess.run([sys.executable, HVPROG, "-p", self.port] + list(arguments), stdout=subprocess.PIPE,
+                                stderr=subprocess.STDOUT, timeout=120)
+        output = result.stdout.decode("ascii", "replace")
+        self.assertEqual(result.returncode, 0, output)
+        return output
+
+    def check_flash(self, image):
+        name = tempfile.mktemp(suffix=".bin")
+        try:
+            self.run_tool("read", name)
+            with open(name, "rb") as file:
+                flash = file.read()
+        finally:
+            if os.path.exists(name):
+                os.unlink(name)
+        self.assertEqual(len(flash), 8192)
+        self.assertEqual(flash[:len(image)], image)
+        self.assertEqual(flash[len(image):], b"\xFF" * (8192 - len(image)))
+
+    def test_1_identify(self):
+        self.assertIn("ATtiny85 signature 0x930B fuses 62 DF FF", self.run_tool("identify"))
+
+    def test_2_program(self):
+        image = bytes((i * 7) & 0xFF for i in range(3000))
+        image = image[:1024] + b"\xFF" * 64 + image[1088:]  # Blank page is skipped
+        name = write_temporary_file(create_intel_hex(image))
+        try:
+            self.assertIn("ATtiny85: 46 pages written, 82 blank pages skipped", self.run_tool("program", name))
+        finally:
+            os.unlink(name)
+        self.check_flash(image)
+
+    def test_3_program_text(self):
+        image = bytes((i * 13) & 0xFF for i in range(2000))
+        name = write_temporary_file(create_intel_hex(image))
+        try:
+            self.assertIn("32 flash pages written, 0 blank pages skipped.", self.run_tool("program", "--text", name))
+        finally:
+            os.unlink(name)
+        self.check_flash(image)
+
+    def test_4_statistics(self):
+        output = self.run_tool("stats")
+        self.assertIn("cycles 1 passed 1 failed 0", output)  # The text command 'p'
+        self.assertIn("timeouts read 0 write 0 erase 0 watchdog 0", output)
+
+
+def main():
+    global SIMULATOR
+    if len(sys.argv) > 1:
+        SIMULATOR = os.path.abspath(sys.argv.pop(1))
+    unittest.main(verbosity=2)
+
+
+if __name__ == "__main__":
+    main()
@@ -4,6 +4,10 @@
  */
 
 #include <Arduino.h>
+#include <util/crc16.h>
+#include <avr/eeprom.h>
+#include <util/delay_basic.h>
+#include <avr/wdt.h>
 
 // AVR High-voltage Serial Fuse Reprogrammer
 // Adapted from code and design by Paul Willoughby 03/20/2010
@@ -25,36 +29,967 @@
 //#define SERIAL_BAUDRATE 19200
 #define SERIAL_BAUDRATE 115200
 
+#if defined(HVPP)
+#define START_BUTTON_PIN A7 // connect a button to ground and a 10 kOhm pull-up resistor to VCC, see HVPP pin assignment
+#define START_BUTTON_PIN_NAME "A7"
+#else
 #define START_BUTTON_PIN 6 // connect a button to ground
+#define START_BUTTON_PIN_NAME "6"
+#endif
 
-#define READING_TIMEOUT_MILLIS 300 // for each shiftOut -> effective timeout is 4 times ore more this single timeout
+/*
+ * HVSP_MINIMAL compiles out the text UI. Only the button, which restores the default fuses, and the binary host protocol remain.
+ * The text commands, the Intel HEX parser with its page images, the EEPROM snapshot of 'k', batch mode and the log buffer are removed,
+ * the linker drops their unreferenced functions and buffers. The freed RAM is used for the largest possible binary frames.
+ * See "SRAM budget" in README.md.
+ */
+//#define HVSP_MINIMAL
+#if defined(HVSP_MINIMAL) && defined(HVSP_BENCHMARK)
+#error HVSP_BENCHMARK requires the text UI, which is not available with HVSP_MINIMAL
+#endif
+
+/*
+ * Timeouts for waiting until the target signals ready by SDO going high.
+ * Read frames get the short timeout, so a missing ATtiny is detected after the first frame.
+ * A write or erase frame selects the longer timeout for the next wait (see expectTargetBusy()).
+ */
+#define HVSP_READY_TIMEOUT_READ_MICROS 1000
+#define HVSP_READY_TIMEOUT_WRITE_MICROS 10000 // Fuse and lock bits. Datasheet value is 4.5 ms
+#define HVSP_READY_TIMEOUT_ERASE_MICROS 20000 // Chip erase. Datasheet value is 9 ms
+
+// Values for sHVSPStatus
+#define HVSP_OK 0
+#define HVSP_ERROR_TIMEOUT 1 // SDO did not go high in time, i.e. no or a defect ATtiny is attached
 
 #define RST A4 // Output to level shifter for !RESET from transistor
+#if defined(HVSP_TIMER_SCI)
+#define SCI 9 // Target Clock Input at OC1A for the timer SCI engine
+#else
 #define SCI A5 // Target Clock Input
+#endif
 #define SDO 5 // Target Data Output
 #define SII 4 // Target Instruction Input
 #define SDI 3 // Target Data Input
 #define VCC 2 // Target VCC
 
+/*
+ * High voltage parallel programming (HVPP) for parts without HVSP interface, enabled by defining HVPP.
+ * The parallel engine parallelOut() replaces shiftOut() and executes the same HVSP frame tables,
+ * since the bits of an HVSP instruction byte are the levels of the parallel control lines.
+ * Then only parts with DEVICE_FLAG_PARALLEL_PROGRAMMING are supported.
+ * Data bit 0 to 5 are at PB0 to PB5 (D8 to D13) and bit 6 and 7 are at PC0 and PC1 (A0 and A1),
+ * since the Nano has no free complete port. So a byte is put on the bus or read by one access per port.
+ * The LED at D13 shows data bit 5 then. VCC, RST and XTAL1 (at the place of SCI) are the same as for HVSP.
+ * RDY/BSY and the button are at the analog only pins A6 and A7, which are read by the analog comparator against the 1.1 V bandgap.
+ * For parts with combined pins like the ATtiny2313, connect BS1/PAGEL to BS1 and XA1/BS2 to XA1.
+ * BS1 is driven as BS1 or PAGEL, and XA1 carries BS2 outside of the XTAL1 pulse, which fits both pin variants.
+ * Not combinable with gang programming and the timer SCI engine.
+ */
+#if defined(HVPP)
+#if !defined(__AVR_ATmega328P__) && !defined(__AVR_ATmega328__) && !defined(__AVR_ATmega168__) && !defined(__AVR_ATmega168P__)
+#error HVPP requires the port and analog comparator registers of an ATmega328 or ATmega168 based board
+#endif
+#if defined(HVSP_GANG_SOCKETS) || defined(HVSP_TIMER_SCI) || defined(HVSP_EXTERNAL_PIN_IO)
+#error HVPP is not available with HVSP_GANG_SOCKETS, HVSP_TIMER_SCI or HVSP_EXTERNAL_PIN_IO
+#endif
+#define HVPP_ENGINE
+#define XTAL1 SCI
+#define OE 3 // Output enable, active low
+#define WR 4 // Write pulse, active low
+#define BS1 5 // Byte select 1, also PAGEL of parts with combined BS1/PAGEL pin
+#define PAGEL 6 // Program memory and EEPROM data latch
+#define XA0 7
+#define XA1 A2 // Also BS2 of parts with combined XA1/BS2 pin
+#define BS2 A3 // Byte select 2
+#define HVPP_DATA_LOW_MASK 0x3F // Data bit 0 to 5 at PORTB
+#define HVPP_DATA_HIGH_MASK 0x03 // Data bit 6 and 7 at PORTC
+#define HVPP_RDY_MUX 6 // A6
+#define HVPP_BUTTON_MUX 7 // A7
+#define HVPP_COMPARATOR_SETTLE_CYCLES 32 // 2 us at 16 MHz after switching the comparator input
+#define HVPP_XTAL1_PULSE_CYCLES 4 // 250 ns at 16 MHz, datasheet minimum is 150 ns
+#define HVPP_OE_TO_DATA_CYCLES 4 // 250 ns at 16 MHz, same as the datasheet maximum
+
+// Control line levels in the HVSP instruction byte
+#define INSTRUCTION_XA1 0x40
+#define INSTRUCTION_XA0 0x20
+#define INSTRUCTION_BS1 0x10
+#define INSTRUCTION_WR 0x08 // 0 is active
+#define INSTRUCTION_OE 0x04 // 0 is active
+#define INSTRUCTION_BS2 0x02
+#define INSTRUCTION_PAGEL 0x01
+#endif
+
+/*
+ * Direct port access for the HVSP lines.
+ * The pin numbers above are mapped at compile time to their PORTx/PINx registers and bit masks,
+ * so each access in shiftOut() compiles to a single sbi/cbi/sbic instruction instead of a digitalWrite() table lookup.
+ * Boards without a known mapping fall back to digitalWrite() / digitalRead().
+ *
+ * The HVSP layer accesses its lines only by the fastDigitalWriteHigh(), fastDigitalWriteLow(), fastDigitalRead(),
+ * fastPinModeOutput() and fastPinModeInput() macros. If HVSP_EXTERNAL_PIN_IO is defined, these macros must be supplied
+ * by the build, e.g. by a forced include, which allows to connect the HVSP layer to a simulated target on a host.
+ * Timer SCI engine and gang programming require the direct port access and are not available then.
+ */
+#if defined(HVSP_EXTERNAL_PIN_IO)
+#if !defined(fastDigitalRead)
+#error HVSP_EXTERNAL_PIN_IO requires the fastDigital*() and fastPinMode*() macros
+#endif
+#elif defined(__AVR_ATmega328P__) || defined(__AVR_ATmega328__) || defined(__AVR_ATmega168__) || defined(__AVR_ATmega168P__)
+#define HVSP_PORT_IO
+#define PIN_TO_PORT_REGISTER(aPin) ((aPin) < 8 ? &PORTD : ((aPin) < 14 ? &PORTB : &PORTC))
+#define PIN_TO_PIN_REGISTER(aPin) ((aPin) < 8 ? &PIND : ((aPin) < 14 ? &PINB : &PINC))
+#define PIN_TO_BIT_MASK(aPin) (_BV((aPin) < 8 ? (aPin) : ((aPin) < 14 ? (aPin) - 8 : (aPin) - 14)))
+#define PIN_TO_DDR_REGISTER(aPin) ((aPin) < 8 ? &DDRD : ((aPin) < 14 ? &DDRB : &DDRC))
+#define fastDigitalWriteHigh(aPin) (*PIN_TO_PORT_REGISTER(aPin) |= PIN_TO_BIT_MASK(aPin))
+#define fastDigitalWriteLow(aPin) (*PIN_TO_PORT_REGISTER(aPin) &= ~PIN_TO_BIT_MASK(aPin))
+#define fastDigitalRead(aPin) ((*PIN_TO_PIN_REGISTER(aPin) & PIN_TO_BIT_MASK(aPin)) != 0)
+#define fastPinModeOutput(aPin) (*PIN_TO_DDR_REGISTER(aPin) |= PIN_TO_BIT_MASK(aPin))
+#define fastPinModeInput(aPin) (*PIN_TO_DDR_REGISTER(aPin) &= ~PIN_TO_BIT_MASK(aPin))
+#else
+#define fastDigitalWriteHigh(aPin) digitalWrite(aPin, HIGH)
+#define fastDigitalWriteLow(aPin) digitalWrite(aPin, LOW)
+#define fastDigitalRead(aPin) digitalRead(aPin)
+#define fastPinModeOutput(aPin) pinMode(aPin, OUTPUT)
+#define fastPinModeInput(aPin) pinMode(aPin, INPUT)
+#endif
+
+/*
+ * Fixed half period of the SCI clock in CPU cycles, added to the instruction time of the port access and to the SCI rate delay.
+ * The datasheet requires at least 125 ns for the SCI high and low phase,
+ * which the port access and the check of the SCI rate delay already exceed with 5 cycles at 16 MHz.
+ */
+#if !defined(HVSP_SCI_HALF_PERIOD_CYCLES)
+#define HVSP_SCI_HALF_PERIOD_CYCLES 0
+#endif
+
+/*
+ * Optional SCI clock generated by timer 1 in fast PWM mode on OC1A, enabled by defining HVSP_TIMER_SCI.
+ * The clock edges are then exactly timed by hardware and independent of the instruction timing of the loop,
+ * software only sets SDI and SII and samples SDO in the low phase after each compare match.
+ * Hardware SPI and the USART in master SPI mode are not usable here, since they shift only one data line in units of 8 bits,
+ * but a HVSP frame has 11 bits on SDI and SII in parallel. And the USART is required for the serial connection to the host.
+ * Requires SCI at OC1A, which is pin 9 on a Nano, instead of A5, and the direct port access.
+ * The low phase must be long enough for the software part, so the clock is not faster than the bit-bang one.
+ * Interrupts are disabled during a frame, since an interrupt service routine would not fit into the low phase.
+ */
+#if defined(HVSP_TIMER_SCI)
+#if !defined(HVSP_PORT_IO)
+#error HVSP_TIMER_SCI requires the direct port access of an ATmega328 or ATmega168 based board
+#endif
+#if SCI != 9
+#error "HVSP_TIMER_SCI requires SCI at OC1A (pin 9)"
+#endif
+#define HVSP_TIMER_SCI_ENGINE
+#define HVSP_TIMER_SCI_PERIOD_CYCLES 48 // 3 us at 16 MHz
+#define HVSP_TIMER_SCI_HIGH_CYCLES 4 // 250 ns at 16 MHz
+#define HVSP_TIMER_SCI_START_CYCLES 16 // Delay from start of timer to first rising edge of SCI
+#endif
+
+/*
+ * Runtime selectable SCI rate of the bit-bang shiftOut().
+ * A rate is the number of 3 cycle delay loops added to each half period of SCI, index 0 is the slowest rate.
+ * The command 't' steps up the rate and stores the fastest stable one minus a safety margin in the EEPROM of the programmer,
+ * where it is read from at startup. Erased EEPROM selects the default rate, which has about the timing of former versions.
+ * Not available for the timer SCI engine, whose clock is fixed by HVSP_TIMER_SCI_PERIOD_CYCLES.
+ */
+#if !defined(HVSP_TIMER_SCI_ENGINE) && !defined(HVPP)
+#define SCI_AUTO_TUNE
+#define SCI_RATE_DEFAULT_INDEX 7
+#define SCI_TUNE_REPETITIONS 32 // Signature and fuse reads, which must all match the reference values for a stable rate
+#define SCI_TUNE_MARGIN 1 // Number of rates to step back from the fastest stable one
+const uint8_t SCIRateDelayLoops[] PROGMEM = { 128, 64, 32, 16, 8, 4, 2, 1, 0 };
+#define NUMBER_OF_SCI_RATES (sizeof(SCIRateDelayLoops))
+uint8_t sSCIRateIndex = SCI_RATE_DEFAULT_INDEX;
+uint8_t sSCIDelayLoops = 1; // Copy of SCIRateDelayLoops[sSCIRateIndex]
+#endif
+
 // Address of the fuses
 #define HFUSE 0x747C
 #define LFUSE 0x646C
 #define EFUSE 0x666E
+// Address of the fuses for reading
+#define LFUSE_READ 0x686C
+#define HFUSE_READ 0x7A7E
+#define EFUSE_READ 0x6A6E
+
+// Index of fuse in arrays of fuse values
+#define LFUSE_INDEX 0
+#define HFUSE_INDEX 1
+#define EFUSE_INDEX 2
+#define MAX_NUMBER_OF_FUSES 3
+
+// Values of fuse status of programming sequence
+#define FUSE_STATUS_UNCHANGED '=' // Had default value already and was not written
+#define FUSE_STATUS_WRITTEN 'W' // Written and verified
+#define FUSE_STATUS_VERIFY_ERROR 'X' // Written, but read back value differs
+#define FUSE_STATUS_TIMEOUT 'T'
+
+const uint16_t FuseWriteAddresses[MAX_NUMBER_OF_FUSES] PROGMEM = { LFUSE, HFUSE, EFUSE };
+const uint16_t FuseReadAddresses[MAX_NUMBER_OF_FUSES] PROGMEM = { LFUSE_READ, HFUSE_READ, EFUSE_READ };
+const char FuseNames[MAX_NUMBER_OF_FUSES] PROGMEM = { 'L', 'H', 'E' };
+
+/*
+ * Gang programming of up to 4 sockets, enabled by defining HVSP_GANG_SOCKETS as the number of sockets.
+ * RST, VCC, SDI, SII and SCI are shared, SDO of socket n is connected to A0 + n, i.e. bit n of port C.
+ * Each of these SDO lines requires a pull down resistor of e.g. 100 kOhm, so that an empty socket is detected as not ready.
+ * All sockets get the same frames and the SDO lines of all sockets are sampled by one port read per clock.
+ * shiftOut() returns the value of the first active socket, so all commands work as before for this socket.
+ * A socket is removed from the active ones if it does not get ready in time or has another signature than the first one.
+ */
+#if defined(HVSP_GANG_SOCKETS)
+#if !defined(HVSP_PORT_IO)
+#error HVSP_GANG_SOCKETS requires the direct port access of an ATmega328 or ATmega168 based board
+#endif
+#define HVSP_GANG
+#if HVSP_GANG_SOCKETS > 4
+#error Only 4 sockets are supported, since only A0 to A3 are free
+#endif
+#define GANG_SDO_PORT PORTC
+#define GANG_SDO_PIN PINC
+#define GANG_SDO_DDR DDRC
+#define GANG_SOCKET_MASK ((1 << HVSP_GANG_SOCKETS) - 1)
+#define GANG_MAX_RESULTS 3 // Enough for signature and fuse sequences
+
+struct GangSocket {
+    uint16_t Signature;
+    uint8_t Fuses[MAX_NUMBER_OF_FUSES];
+    char FuseStatus[MAX_NUMBER_OF_FUSES];
+} sGangSockets[HVSP_GANG_SOCKETS];
+
+uint8_t sGangActiveMask; // Bit n is set if socket n takes part in the current programming
+uint8_t sGangFrameResults[HVSP_GANG_SOCKETS]; // SDO values of the last frame
+uint8_t sGangResults[HVSP_GANG_SOCKETS][GANG_MAX_RESULTS]; // SDO values stored by the last sequence
+
+#define isTargetReady() ((GANG_SDO_PIN & sGangActiveMask) == sGangActiveMask)
+#elif defined(HVPP_ENGINE)
+#define isTargetReady() (!(ACSR & _BV(ACO))) // Comparator output is 1 for RDY/BSY below the bandgap voltage
+#else
+#define isTargetReady() fastDigitalRead(SDO)
+#endif
+
+/*
+ * HVSP transactions
+ * An operation is a PROGMEM table of (SDI, SII) frames which is shifted back-to-back by executeHVSPSequence().
+ * The flags allow to take SDI or SII values from a caller supplied argument list,
+ * to store the SDO value of a frame in a caller supplied buffer and to announce a busy target after the frame.
+ */
+struct HVSPFrame {
+    uint8_t SDIValue;
+    uint8_t SIIValue;
+    uint8_t Flags;
+};
+#define FRAME_SDI_FROM_ARGUMENT 0x01 // Use next argument instead of SDIValue
+#define FRAME_SII_FROM_ARGUMENT 0x02 // Use next argument instead of SIIValue, SDI argument is taken first
+#define FRAME_STORE_SDO 0x04 // Append SDO value of this frame to result buffer
+#define FRAME_BUSY_WRITE 0x08 // Target is busy writing after this frame
+#define FRAME_BUSY_ERASE 0x10 // Target is busy erasing after this frame
+
+#define HVSP_SEQUENCE_LENGTH(aSequence) (sizeof(aSequence) / sizeof(HVSPFrame))
+#define runHVSPSequence(aSequence, aArguments, aResultBuffer) executeHVSPSequence(aSequence, HVSP_SEQUENCE_LENGTH(aSequence), aArguments, aResultBuffer)
+
+// Arguments: signature byte address 1 and 2. Result: signature byte 1 and 2
+const HVSPFrame ReadSignatureSequence[] PROGMEM = {
+        { 0x08, 0x4C, 0 }, { 0x00, 0x0C, FRAME_SDI_FROM_ARGUMENT }, { 0x00, 0x68, 0 }, { 0x00, 0x6C, FRAME_STORE_SDO },
+        { 0x08, 0x4C, 0 }, { 0x00, 0x0C, FRAME_SDI_FROM_ARGUMENT }, { 0x00, 0x68, 0 }, { 0x00, 0x6C, FRAME_STORE_SDO } };
+
+// Result: low, high and extended fuse
+const HVSPFrame ReadFusesSequence[] PROGMEM = {
+        { 0x04, 0x4C, 0 }, { 0x00, 0x68, 0 }, { 0x00, 0x6C, FRAME_STORE_SDO }, // LFuse
+        { 0x04, 0x4C, 0 }, { 0x00, 0x7A, 0 }, { 0x00, 0x7E, FRAME_STORE_SDO }, // HFuse
+        { 0x04, 0x4C, 0 }, { 0x00, 0x6A, 0 }, { 0x00, 0x6E, FRAME_STORE_SDO } }; // EFuse
+
+/*
+ * Complete characterisation of a chip in one pass, each command is loaded only once.
+ * Result: see struct IdentifyResult
+ */
+const HVSPFrame IdentifySequence[] PROGMEM = {
+        { 0x08, 0x4C, 0 }, // Read signature and calibration byte
+        { 0x00, 0x0C, 0 }, { 0x00, 0x68, 0 }, { 0x00, 0x6C, FRAME_STORE_SDO }, // Signature byte 0
+        { 0x01, 0x0C, 0 }, { 0x00, 0x68, 0 }, { 0x00, 0x6C, FRAME_STORE_SDO }, // Signature byte 1
+        { 0x02, 0x0C, 0 }, { 0x00, 0x68, 0 }, { 0x00, 0x6C, FRAME_STORE_SDO }, // Signature byte 2
+        { 0x00, 0x0C, 0 }, { 0x00, 0x78, 0 }, { 0x00, 0x7C, FRAME_STORE_SDO }, // Calibration byte 0
+        { 0x01, 0x0C, 0 }, { 0x00, 0x78, 0 }, { 0x00, 0x7C, FRAME_STORE_SDO }, // Calibration byte 1
+        { 0x04, 0x4C, 0 }, // Read fuse and lock bits
+        { 0x00, 0x68, 0 }, { 0x00, 0x6C, FRAME_STORE_SDO }, // LFuse
+        { 0x00, 0x7A, 0 }, { 0x00, 0x7E, FRAME_STORE_SDO }, // HFuse
+        { 0x00, 0x6A, 0 }, { 0x00, 0x6E, FRAME_STORE_SDO }, // EFuse
+        { 0x00, 0x78, 0 }, { 0x00, 0x7C, FRAME_STORE_SDO } }; // Lock bits
+
+struct IdentifyResult {
+    uint8_t Signature[3];
+    uint8_t Calibration[2]; // The second byte is only used by the ATtiny13, for 4.8 MHz
+    uint8_t Fuses[MAX_NUMBER_OF_FUSES];
+    uint8_t LockBits;
+};
+
+// Arguments: high and low byte of fuse read address (LFUSE_READ, HFUSE_READ, EFUSE_READ). Result: fuse value
+const HVSPFrame ReadFuseSequence[] PROGMEM = {
+        { 0x04, 0x4C, 0 }, { 0x00, 0x00, FRAME_SII_FROM_ARGUMENT }, { 0x00, 0x00, FRAME_SII_FROM_ARGUMENT | FRAME_STORE_SDO } };
+
+// Arguments: fuse value, high and low byte of fuse address (LFUSE, HFUSE, EFUSE)
+const HVSPFrame WriteFuseSequence[] PROGMEM = {
+        { 0x40, 0x4C, 0 }, { 0x00, 0x2C, FRAME_SDI_FROM_ARGUMENT },
+        { 0x00, 0x00, FRAME_SII_FROM_ARGUMENT }, { 0x00, 0x00, FRAME_SII_FROM_ARGUMENT | FRAME_BUSY_WRITE } };
+
+const HVSPFrame LoadReadFlashCommandSequence[] PROGMEM = { { 0x02, 0x4C, 0 } };
+
+// Arguments: low and high byte of word address. Result: low and high byte of flash word
+const HVSPFrame ReadFlashWordSequence[] PROGMEM = {
+        { 0x00, 0x0C, FRAME_SDI_FROM_ARGUMENT }, { 0x00, 0x1C, FRAME_SDI_FROM_ARGUMENT },
+        { 0x00, 0x68, 0 }, { 0x00, 0x6C, FRAME_STORE_SDO }, { 0x00, 0x78, 0 }, { 0x00, 0x7C, FRAME_STORE_SDO } };
+
+// Erases flash, EEPROM (if EESAVE fuse is not programmed) and lock bits
+const HVSPFrame ChipEraseSequence[] PROGMEM = { { 0x80, 0x4C, 0 }, { 0x00, 0x64, 0 }, { 0x00, 0x6C, FRAME_BUSY_ERASE } };
+
+const HVSPFrame LoadWriteFlashCommandSequence[] PROGMEM = { { 0x10, 0x4C, 0 } };
+
+// Arguments: low byte of word address, low and high byte of flash word
+#if defined(HVPP_ENGINE)
+// Parallel parts latch both bytes by one PAGEL pulse, which must be a pulse of BS1 for parts with combined BS1/PAGEL pin
+const HVSPFrame LoadFlashPageBufferWordSequence[] PROGMEM = {
+        { 0x00, 0x0C, FRAME_SDI_FROM_ARGUMENT }, { 0x00, 0x2C, FRAME_SDI_FROM_ARGUMENT }, { 0x00, 0x3C, FRAME_SDI_FROM_ARGUMENT },
+        { 0x00, 0x6C, 0 }, { 0x00, 0x6D, 0 }, { 0x00, 0x6C, 0 } };
+#else
+const HVSPFrame LoadFlashPageBufferWordSequence[] PROGMEM = {
+        { 0x00, 0x0C, FRAME_SDI_FROM_ARGUMENT }, { 0x00, 0x2C, FRAME_SDI_FROM_ARGUMENT }, { 0x00, 0x6D, 0 }, { 0x00, 0x6C, 0 },
+        { 0x00, 0x3C, FRAME_SDI_FROM_ARGUMENT }, { 0x00, 0x7D, 0 }, { 0x00, 0x7C, 0 } };
+#endif
+
+// Arguments: high byte of word address
+const HVSPFrame WriteFlashPageSequence[] PROGMEM = {
+        { 0x00, 0x1C, FRAME_SDI_FROM_ARGUMENT }, { 0x00, 0x64, 0 }, { 0x00, 0x6C, FRAME_BUSY_WRITE } };
+
+const HVSPFrame LoadReadEEPROMCommandSequence[] PROGMEM = { { 0x03, 0x4C, 0 } };
+
+// Arguments: low and high byte of address. Result: EEPROM byte
+const HVSPFrame ReadEEPROMByteSequence[] PROGMEM = {
+        { 0x00, 0x0C, FRAME_SDI_FROM_ARGUMENT }, { 0x00, 0x1C, FRAME_SDI_FROM_ARGUMENT }, { 0x00, 0x68, 0 }, { 0x00, 0x6C, FRAME_STORE_SDO } };
+
+// Arguments: low and high byte of address, data byte
+const HVSPFrame WriteEEPROMByteSequence[] PROGMEM = {
+        { 0x11, 0x4C, 0 }, { 0x00, 0x0C, FRAME_SDI_FROM_ARGUMENT }, { 0x00, 0x1C, FRAME_SDI_FROM_ARGUMENT },
+        { 0x00, 0x2C, FRAME_SDI_FROM_ARGUMENT }, { 0x00, 0x6D, 0 }, { 0x00, 0x64, 0 }, { 0x00, 0x6C, FRAME_BUSY_WRITE } };
+
+const HVSPFrame LoadWriteEEPROMCommandSequence[] PROGMEM = { { 0x11, 0x4C, 0 } };
+
+// Arguments: high byte of address
+const HVSPFrame LoadEEPROMAddressHighSequence[] PROGMEM = { { 0x00, 0x1C, FRAME_SDI_FROM_ARGUMENT } };
+
+// Arguments: low byte of address, data byte
+const HVSPFrame LoadEEPROMPageBufferByteSequence[] PROGMEM = {
+        { 0x00, 0x0C, FRAME_SDI_FROM_ARGUMENT }, { 0x00, 0x2C, FRAME_SDI_FROM_ARGUMENT }, { 0x00, 0x6D, 0 }, { 0x00, 0x6C, 0 } };
+
+const HVSPFrame WriteEEPROMPageSequence[] PROGMEM = { { 0x00, 0x64, 0 }, { 0x00, 0x6C, FRAME_BUSY_WRITE } };
+
+// Loading the no operation command ends programming mode of flash and EEPROM
+const HVSPFrame NoOperationSequence[] PROGMEM = { { 0x00, 0x4C, 0 } };
 
 // Define ATTiny series signatures
-#define ATTINY13 0x9007 // L: 0x6A, H: 0xFF 8 pin
-#define ATTINY24 0x910B // L: 0x62, H: 0xDF, E: 0xFF 14 pin
-#define ATTINY25 0x9108 // L: 0x62, H: 0xDF, E: 0xFF 8 pin
-#define ATTINY44 0x9207 // L: 0x62, H: 0xDF, E: 0xFFF 14 pin
-#define ATTINY45 0x9206 // L: 0x62, H: 0xDF, E: 0xFF 8 pin
-#define ATTINY84 0x930C // L: 0x62, H: 0xDF, E: 0xFFF 14 pin
-#define ATTINY85 0x930B // L: 0x62, H: 0xDF, E: 0xFF 8 pin
+#define ATTINY13 0x9007 // 8 pin
+#define ATTINY24 0x910B // 14 pin
+#define ATTINY25 0x9108 // 8 pin
+#define ATTINY44 0x9207 // 14 pin
+#define ATTINY45 0x9206 // 8 pin
+#define ATTINY84 0x930C // 14 pin
+#define ATTINY85 0x930B // 8 pin
+#define ATTINY43U 0x920C // 20 pin
+#define ATTINY2313 0x910A // 20 pin, parallel programming only
+#define ATTINY261 0x910C // 20 pin, parallel programming only
+#define ATTINY461 0x9208 // 20 pin, parallel programming only
+#define ATTINY861 0x930D // 20 pin, parallel programming only
+#define ATMEGA48 0x9205 // 28 pin, parallel programming only
+#define ATMEGA48P 0x920A
+#define ATMEGA88 0x930A
+#define ATMEGA88P 0x930F
+#define ATMEGA168 0x9406
+#define ATMEGA168P 0x940B
+#define ATMEGA328 0x9514
+#define ATMEGA328P 0x950F
+
+/*
+ * Device table, located in flash and accessed by pgm_read_*().
+ * Adding a part requires just a new entry.
+ */
+#define DEVICE_NAME_SIZE 12
+#define DEVICE_FLAG_PARALLEL_PROGRAMMING 0x01 // Part has no HVSP interface
+struct DeviceInfo {
+    uint16_t Signature; // Signature byte 1 and 2
+    char Name[DEVICE_NAME_SIZE];
+    uint8_t DefaultFuses[MAX_NUMBER_OF_FUSES]; // Low, high and extended
+    uint8_t NumberOfFuses; // 2 if part has no extended fuse
+    uint16_t FlashSize; // In bytes
+    uint16_t EEPROMSize;
+    uint8_t FlashPageSize; // In bytes
+    uint8_t EEPROMPageSize;
+    uint8_t Flags;
+};
+
+const DeviceInfo DeviceTable[] PROGMEM = {
+/*      Signature   Name          L     H     E      Fuses Flash EEPROM Page EEPage Flags */
+        { ATTINY13, "ATtiny13", { 0x6A, 0xFF, 0xFF }, 2, 1024, 64, 32, 4, 0 },
+        { ATTINY24, "ATtiny24", { 0x62, 0xDF, 0xFF }, 3, 2048, 128, 32, 4, 0 },
+        { ATTINY44, "ATtiny44", { 0x62, 0xDF, 0xFF }, 3, 4096, 256, 64, 4, 0 },
+        { ATTINY84, "ATtiny84", { 0x62, 0xDF, 0xFF }, 3, 8192, 512, 64, 4, 0 },
+        { ATTINY25, "ATtiny25", { 0x62, 0xDF, 0xFF }, 3, 2048, 128, 32, 4, 0 },
+        { ATTINY45, "ATtiny45", { 0x62, 0xDF, 0xFF }, 3, 4096, 256, 64, 4, 0 },
+        { ATTINY85, "ATtiny85", { 0x62, 0xDF, 0xFF }, 3, 8192, 512, 64, 4, 0 },
+        { ATTINY43U, "ATtiny43U", { 0x62, 0xDF, 0xFF }, 3, 4096, 64, 64, 4, 0 },
+        { ATTINY2313, "ATtiny2313", { 0x64, 0xDF, 0xFF }, 3, 2048, 128, 32, 4, DEVICE_FLAG_PARALLEL_PROGRAMMING },
+        { ATTINY261, "ATtiny261", { 0x62, 0xDF, 0xFF }, 3, 2048, 128, 32, 4, DEVICE_FLAG_PARALLEL_PROGRAMMING },
+        { ATTINY461, "ATtiny461", { 0x62, 0xDF, 0xFF }, 3, 4096, 256, 64, 4, DEVICE_FLAG_PARALLEL_PROGRAMMING },
+        { ATTINY861, "ATtiny861", { 0x62, 0xDF, 0xFF }, 3, 8192, 512, 64, 4, DEVICE_FLAG_PARALLEL_PROGRAMMING },
+        { ATMEGA48, "ATmega48", { 0x62, 0xDF, 0xFF }, 3, 4096, 256, 64, 4, DEVICE_FLAG_PARALLEL_PROGRAMMING },
+        { ATMEGA48P, "ATmega48P", { 0x62, 0xDF, 0xFF }, 3, 4096, 256, 64, 4, DEVICE_FLAG_PARALLEL_PROGRAMMING },
+        { ATMEGA88, "ATmega88", { 0x62, 0xDF, 0xF9 }, 3, 8192, 512, 64, 4, DEVICE_FLAG_PARALLEL_PROGRAMMING },
+        { ATMEGA88P, "ATmega88P", { 0x62, 0xDF, 0xF9 }, 3, 8192, 512, 64, 4, DEVICE_FLAG_PARALLEL_PROGRAMMING },
+        { ATMEGA168, "ATmega168", { 0x62, 0xDF, 0xF9 }, 3, 16384, 512, 128, 4, DEVICE_FLAG_PARALLEL_PROGRAMMING },
+        { ATMEGA168P, "ATmega168P", { 0x62, 0xDF, 0xF9 }, 3, 16384, 512, 128, 4, DEVICE_FLAG_PARALLEL_PROGRAMMING },
+        { ATMEGA328, "ATmega328", { 0x62, 0xD9, 0xFF }, 3, 32768, 1024, 128, 4, DEVICE_FLAG_PARALLEL_PROGRAMMING },
+        { ATMEGA328P, "ATmega328P", { 0x62, 0xD9, 0xFF }, 3, 32768, 1024, 128, 4, DEVICE_FLAG_PARALLEL_PROGRAMMING } };
+
+// Parts of the other programming mode are detected, but rejected
+#if defined(HVPP_ENGINE)
+#define isDeviceSupported(aDevicePGM) ((pgm_read_byte(&(aDevicePGM)->Flags) & DEVICE_FLAG_PARALLEL_PROGRAMMING) != 0)
+#else
+#define isDeviceSupported(aDevicePGM) ((pgm_read_byte(&(aDevicePGM)->Flags) & DEVICE_FLAG_PARALLEL_PROGRAMMING) == 0)
+#endif
+
+/*
+ * Batch mode
+ * The socket is polled by a short power up and signature read. Between polls VCC and 12 V are off.
+ */
+#define BATCH_POLL_INTERVAL_MILLIS 200
+#define BATCH_STABLE_POLLS 2 // Number of consecutive identical polls required to detect insertion or removal
+
+/*
+ * Programming sequence as cooperative state machine, which is called by loop().
+ * No state blocks longer than the HVSP frames it shifts, waits are deadlines checked at each call.
+ * The start button is debounced by a timer tick of 1 ms.
+ */
+#define STATE_IDLE 0 // Wait for command or button
+#define STATE_COLLECT_COMMAND 1 // Wait for the rest of the command line, e.g. CR/LF
+#define STATE_POWER_UP 2
+#define STATE_IDENTIFY 3 // Read signature and fuses
+#define STATE_WRITE_FUSE 4 // Start write of the fuse at FuseIndex if it differs from target value
+#define STATE_WAIT_FOR_READY 5 // Wait for target, then switch to NextState
+#define STATE_VERIFY_FUSE 6
+#define STATE_FINISH 7
+#define STATE_BATCH_WAIT_FOR_INSERTION 8
+#define STATE_BATCH_WAIT_FOR_REMOVAL 9
+#define STATE_RESTORE_EEPROM 10 // Write the next EEPROM page from the snapshot
+#define STATE_VERIFY_EEPROM 11
+
+#define COMMAND_COLLECT_MILLIS 100
+#define BUTTON_DEBOUNCE_MILLIS 8 // Button state must be stable for this time
+#define BUTTON_LONG_PRESS_MILLIS 1000 // A longer press selects the next fuse profile
+#define COMMAND_LINE_SIZE 32
+
+struct ProgrammingSequence {
+    uint8_t State;
+    uint8_t NextState; // State after STATE_WAIT_FOR_READY
+    uint32_t DeadlineMillis;
+    uint32_t StartMillis; // For the cycle time statistics
+    uint32_t WaitStartMicros;
+    uint16_t WaitTimeoutMicros;
+    char Command; // 0 for button
+    bool IsBatchMode;
+    bool BlinkLED; // Blink while idle to signal end of programming
+    const DeviceInfo *DevicePGM;
+    uint8_t FuseIndex;
+    uint16_t EEPROMAddress; // Next address to restore
+    bool EEPROMVerifyError;
+    uint8_t Fuses[MAX_NUMBER_OF_FUSES]; // Values read at identify
+    uint8_t TargetFuses[MAX_NUMBER_OF_FUSES]; // Values to be written
+    char FuseStatus[MAX_NUMBER_OF_FUSES];
+    uint8_t StablePolls; // For batch mode
+    uint16_t NumberOfPassed;
+    uint16_t NumberOfFailed;
+} sSequence;
+
+/*
+ * Snapshot of the target EEPROM for recover with 'k', which restores it after the chip erase
+ */
+#define MAX_EEPROM_SIZE 512
+#define EEPROM_VERIFY_CHUNK_SIZE 16
+uint8_t sEEPROMSnapshot[MAX_EEPROM_SIZE];
+
+volatile bool sButtonIsDown; // Debounced state
+volatile uint8_t sButtonStableTicks;
+volatile uint16_t sButtonDownMillis; // Duration of current press
+volatile bool sButtonPressedEvent; // Set by timer on release after a short press, reset by consumer
+volatile bool sButtonLongPressEvent; // Set by timer on release after a long press, reset by consumer
+char sCommandLine[COMMAND_LINE_SIZE];
+
+#if defined(HVSP_MINIMAL)
+#define logEvent(...)
+#define flushLog()
+#else
+/*
+ * Deferred logging. While programming, messages are queued as compact records of an event code and up to 3 data bytes.
+ * The texts are in PROGMEM and the records are formatted and sent by flushLog() only when the programming sequence is idle,
+ * so a full serial transmit buffer never delays the HVSP frames.
+ * In the texts, '%' is replaced by the next data byte as 2 hex digits, '#' by the next data byte as decimal number,
+ * '$' by the next data byte as character and '@' by the name of the part with the next data byte as index in DeviceTable.
+ */
+#define LOG_BUFFER_SIZE 16 // Must be a power of 2
+#define LOG_MAX_DATA_BYTES 3
+struct LogRecord {
+    uint8_t Event;
+    uint8_t Data[LOG_MAX_DATA_BYTES];
+};
+LogRecord sLogBuffer[LOG_BUFFER_SIZE];
+uint8_t sLogWriteIndex;
+uint8_t sLogReadIndex;
+uint8_t sNumberOfDroppedLogRecords;
+
+const char LogReadingSignature[] PROGMEM = "Reading signature from connected ATtiny...";
+const char LogSignature[] PROGMEM = "Reading complete..\r\nSignature is: %%";
+const char LogReadyTimeout[] PROGMEM = "Timeout while waiting for ATtiny to get ready.";
+const char LogPowerUpRetry[] PROGMEM = "Retry with power up timing #";
+const char LogReadingFuses[] PROGMEM = "Reading fuse settings from ATtiny...";
+const char LogFuses[] PROGMEM = "LFuse: %, HFuse: %, EFuse: %\r\nReading complete.";
+const char LogFusesTimeout[] PROGMEM = "Timeout while reading fuses.";
+#if defined(HVPP_ENGINE)
+const char LogDetected[] PROGMEM = "The part is detected as @.";
+const char LogWrongProgrammingMode[] PROGMEM = "This part supports only high voltage serial programming.";
+#else
+const char LogDetected[] PROGMEM = "The ATtiny is detected as @.";
+const char LogWrongProgrammingMode[] PROGMEM = "This part supports only high voltage parallel programming.";
+#endif
+const char LogNoValidSignature[] PROGMEM = "No valid ATtiny signature detected! Try again.";
+const char LogUsingFuseProfile[] PROGMEM = "Using fuse profile #";
+const char LogFuseProfileMismatch[] PROGMEM = "Selected fuse profile is for another part, using defaults.";
+const char LogSavingEEPROM[] PROGMEM = "Saving EEPROM...";
+const char LogErasing[] PROGMEM = "Erasing chip...";
+const char LogEEPROMRestored[] PROGMEM = "EEPROM restored.";
+const char LogEEPROMVerifyError[] PROGMEM = "EEPROM verify error.";
+const char LogWriteFuse[] PROGMEM = "Write $FUSE: 0x%";
+const char LogEEPROMTooLarge[] PROGMEM = "EEPROM is too large to be saved, nothing done.";
+const char LogWatchdogTimeout[] PROGMEM = "Watchdog timeout in state #, target was powered down.";
+
+// Index into LogMessages
+#define LOG_READING_SIGNATURE 0
+#define LOG_SIGNATURE 1 // Signature high and low byte
+#define LOG_READY_TIMEOUT 2
+#define LOG_POWER_UP_RETRY 3 // Index of power up timing
+#define LOG_READING_FUSES 4
+#define LOG_FUSES 5 // Low, high and extended fuse
+#define LOG_FUSES_TIMEOUT 6
+#define LOG_DETECTED 7 // Index in DeviceTable
+#define LOG_WRONG_PROGRAMMING_MODE 8
+#define LOG_NO_VALID_SIGNATURE 9
+#define LOG_USING_FUSE_PROFILE 10 // Index of profile
+#define LOG_FUSE_PROFILE_MISMATCH 11
+#define LOG_SAVING_EEPROM 12
+#define LOG_ERASING 13
+#define LOG_EEPROM_RESTORED 14
+#define LOG_EEPROM_VERIFY_ERROR 15
+#define LOG_WRITE_FUSE 16 // Fuse name, value
+#define LOG_EEPROM_TOO_LARGE 17
+#define LOG_WATCHDOG_TIMEOUT 18 // State of programming sequence
+
+const char *const LogMessages[] PROGMEM = { LogReadingSignature, LogSignature, LogReadyTimeout, LogPowerUpRetry, LogReadingFuses,
+        LogFuses, LogFusesTimeout, LogDetected, LogWrongProgrammingMode, LogNoValidSignature, LogUsingFuseProfile, LogFuseProfileMismatch,
+        LogSavingEEPROM, LogErasing, LogEEPROMRestored, LogEEPROMVerifyError, LogWriteFuse, LogEEPROMTooLarge,
+        LogWatchdogTimeout };
+#endif
+
+/*
+ * Fuse profiles in the EEPROM of the programmer, to restore project specific fuses instead of the factory defaults.
+ * A profile is used for a part if it is selected and its signature matches the one of the part.
+ * Profiles are managed by the commands 'l' (list), 's' (store), 'x' (delete) and 'u' (use) or a long press of the button.
+ */
+#define MAX_FUSE_PROFILES 8
+#define FUSE_PROFILE_NAME_SIZE 8 // Including the terminating NUL
+#define FUSE_PROFILE_EMPTY 0xFFFF // Signature of an unused entry, this is the value of erased EEPROM
+#define NO_FUSE_PROFILE 0xFF // Selection for using the factory defaults
+struct FuseProfile {
+    uint16_t Signature;
+    char Name[FUSE_PROFILE_NAME_SIZE];
+    uint8_t Fuses[MAX_NUMBER_OF_FUSES];
+};
+FuseProfile sFuseProfilesEEPROM[MAX_FUSE_PROFILES] EEMEM;
+uint8_t sSelectedFuseProfileEEPROM EEMEM;
+uint8_t sSelectedFuseProfile = NO_FUSE_PROFILE; // Copy of sSelectedFuseProfileEEPROM
+#if defined(SCI_AUTO_TUNE)
+uint8_t sSCIRateIndexEEPROM EEMEM; // Result of the last auto-tune, 0xFF if never tuned
+#endif
+
+#define FLASH_DUMP_RECORD_SIZE 16 // Bytes per Intel HEX record and per Serial.write() of binary dump
+#define FLASH_VERIFY_CHUNK_SIZE 16 // Bytes read at once for CRC calculation
+
+/*
+ * Flash programming from an Intel HEX stream
+ * Bytes are collected in a page image while parsing. A complete page image is queued for writing
+ * and parsing continues into the second image, while the queued one is loaded into the page buffer of the target and written.
+ * During loading and while waiting for the page write, receiveHexCharacters() drains the serial receive buffer,
+ * so the host can send at full baudrate. The USART RX interrupt itself stays owned by HardwareSerial.
+ */
+#if defined(HVPP_ENGINE)
+#define MAX_FLASH_PAGE_SIZE 128 // ATmega168 and ATmega328
+#else
+#define MAX_FLASH_PAGE_SIZE 64
+#endif
+#define FLASH_PAGE_UNUSED 0xFFFF
+#define HEX_INPUT_TIMEOUT_MILLIS 10000 // Abort if no character is received for this time
+
+// Values of sHexParseResult
+#define HEX_PARSE_CONTINUE 0
+#define HEX_PARSE_END_OF_FILE 1
+#define HEX_PARSE_ERROR 2
+#define HEX_PARSE_TIMEOUT 3
+
+#define HEX_WAIT_FOR_RECORD_START 0xFF // Value of ByteIndex between records
+// Byte count, address, type, data and checksum must fit below HEX_WAIT_FOR_RECORD_START
+#define HEX_MAX_RECORD_DATA_LENGTH (HEX_WAIT_FOR_RECORD_START - 5)
+
+struct IntelHexParser {
+    uint8_t ByteIndex; // Index of current byte in record, starting with byte count
+    bool HighNibbleReceived;
+    uint8_t CurrentByte;
+    uint8_t DataLength;
+    uint16_t Address;
+    uint8_t RecordType;
+    uint8_t Checksum;
+} sHexParser;
+uint8_t sHexParseResult;
+uint32_t sLastHexCharacterMillis;
+
+struct FlashPageImage {
+    uint16_t PageAddress; // Byte address of first byte of the page or FLASH_PAGE_UNUSED
+    uint8_t ByteCount; // Number of bytes received for this page
+    uint8_t Data[MAX_FLASH_PAGE_SIZE];
+};
+FlashPageImage sFlashPages[2];
+FlashPageImage *sFillPage; // Page image receiving the parsed bytes
+FlashPageImage *sWritePage; // Page image queued for or being written to target, NULL if none
+bool sFillPageComplete; // Fill page could not be queued, since write page is still in use. Parsing is paused.
+// Byte received for the next page while fill page is complete, it is stored after queuing the fill page
+bool sHeldByteValid;
+uint16_t sHeldByteAddress;
+uint8_t sHeldByte;
+
+uint16_t sFlashSize;
+uint8_t sFlashPageSize;
+uint16_t sNumberOfWrittenPages;
+uint16_t sNumberOfSkippedPages; // Pages with only 0xFF, which are already blank after the chip erase
+
+/*
+ * Binary host protocol
+ * A frame starting with FRAME_SYNC switches from the text UI to the binary protocol for this frame,
+ * since the sync byte is no printable character.
+ * Request:  FRAME_SYNC, sequence number, opcode, payload length, payload, CRC low, CRC high
+ * Response: FRAME_SYNC, sequence number, opcode | OPCODE_RESPONSE, payload length, status, payload, CRC low, CRC high
+ * The response payload length includes the status byte. The sequence number of the request is returned unchanged.
+ * CRC is the CRC-16/CCITT computed by _crc_ccitt_update() with start value 0xFFFF (known as CRC-16/MCRF4XX)
+ * over all bytes from sequence number to the end of the payload.
+ * Multi byte values are little endian. The target is powered up automatically by the first command requiring it.
+ */
+#define PROTOCOL_VERSION 3 // 2: get version returns the max payload size, 3: power up returns the part data
+#define FRAME_SYNC 0xA5
+#define FRAME_HEADER_SIZE 4 // Sync, sequence number, opcode, length
+#define FRAME_CRC_SIZE 2
+#define FRAME_BYTE_TIMEOUT_MILLIS 50 // Max gap between two bytes of a frame
+#if defined(HVSP_MINIMAL)
+#define MAX_FRAME_PAYLOAD_SIZE 255 // Limit of the length byte. Uses the RAM of the text UI for longer reads and more verify pages
+#else
+#define MAX_FRAME_PAYLOAD_SIZE (2 + MAX_FLASH_PAGE_SIZE) // Write flash page request: 2 address bytes, page data
+#endif
+#define MAX_READ_LENGTH (MAX_FRAME_PAYLOAD_SIZE - 1) // Response: status, data
 
+#define OPCODE_RESPONSE 0x80
+#define OPCODE_GET_VERSION 0x01 // -> protocol version, major and minor version of sketch, max payload size
+#define OPCODE_POWER_UP 0x02 // -> signature byte 1 and 2, for a supported part also flash size, flash page size, number of fuses and name.
+                             // Power cycles the target if already powered
+#define OPCODE_POWER_DOWN 0x03
+#define OPCODE_READ_SIGNATURE 0x04 // -> signature byte 1 and 2
+#define OPCODE_READ_FUSES 0x05 // -> low, high and extended fuse
+#define OPCODE_WRITE_FUSE 0x06 // fuse index, value
+#define OPCODE_CHIP_ERASE 0x07
+#define OPCODE_READ_FLASH 0x08 // address, length -> flash bytes
+#define OPCODE_WRITE_FLASH_PAGE 0x09 // address of page, page data. Chip must be erased before
+#define OPCODE_READ_EEPROM 0x0A // address, length -> EEPROM bytes
+#define OPCODE_WRITE_EEPROM 0x0B // address, data bytes
+#define OPCODE_IDENTIFY 0x0C // -> struct IdentifyResult: 3 signature bytes, 2 calibration bytes, 3 fuses, lock bits
+#define OPCODE_READ_TRACE 0x0D // index of first entry, 0 is the oldest -> number of available entries, struct TraceEntry list
+#define OPCODE_CLEAR_TRACE 0x0E
+#define OPCODE_VERIFY_FLASH 0x0F // address, length, expected CRC-32 -> CRC-32 of flash
+#define OPCODE_VERIFY_FLASH_PAGES 0x10 // address of first page, expected CRC-32 of each page -> address of first mismatching page
+#define OPCODE_BLANK_CHECK 0x11 // -> address of first byte of flash which is not 0xFF
+#define OPCODE_READ_STATISTICS 0x12 // 1 to read the EEPROM snapshot instead of the running counters -> struct Statistics
+#define OPCODE_CLEAR_STATISTICS 0x13 // Clears the running counters, not the snapshot
+#define OPCODE_SAVE_STATISTICS 0x14 // Stores the running counters as snapshot in the EEPROM of the programmer
+
+// Status byte of response, values below 0x10 are sHVSPStatus values
+#define STATUS_OK HVSP_OK
+#define STATUS_TIMEOUT HVSP_ERROR_TIMEOUT
+#define STATUS_CRC_ERROR 0x10
+#define STATUS_UNKNOWN_OPCODE 0x11
+#define STATUS_INVALID_ARGUMENT 0x12 // Wrong payload length or address out of range
+#define STATUS_NO_DEVICE 0x13 // No known HVSP part attached
+#define STATUS_VERIFY_ERROR 0x14 // CRC of flash differs from the expected one
+#define STATUS_NOT_BLANK 0x15
+
+uint8_t sFrameBuffer[FRAME_HEADER_SIZE + MAX_FRAME_PAYLOAD_SIZE + FRAME_CRC_SIZE];
+
+bool sIsInProgrammingMode = false;
+const DeviceInfo *sCurrentDevicePGM = NULL; // Device detected at last power up by the binary protocol
+
+/*
+ * Timing of the entry into high voltage serial programming mode, see "High-voltage Serial Programming Algorithm" in the datasheet.
+ * Profile 0 has the datasheet values, the following ones are more relaxed for marginal parts and slow rising supplies.
+ */
+struct PowerUpTiming {
+    uint8_t VCCTo12VMicros; // Datasheet: 20 to 60 us
+    uint8_t HoldProgEnableMicros; // Datasheet: at least 10 us
+    uint16_t SettleMicros; // Datasheet: at least 300 us before the first instruction
+};
+const PowerUpTiming PowerUpTimings[] PROGMEM = { { 20, 10, 300 }, { 40, 20, 500 }, { 60, 50, 1000 } };
+#define NUMBER_OF_POWER_UP_TIMINGS (sizeof(PowerUpTimings) / sizeof(PowerUpTiming))
+
+#if !defined(POWER_UP_TIMING_INDEX)
+#define POWER_UP_TIMING_INDEX 0 // Profile used first for this board
+#endif
+#if !defined(DISABLE_POWER_UP_RETRY)
+#define POWER_UP_RETRY // Retry with the next profile if the signature reads 0x0000 or 0xFFFF
+#endif
+#define POWER_DOWN_MILLIS 10 // Time for VCC of target to drop before the next power up
+
+/*
+ * Watchdog supervision of each HV session, disabled by defining DISABLE_WATCHDOG.
+ * The watchdog is armed by enterHVProgrammingMode() and fed by each executed sequence and each loop() pass.
+ * If the sketch hangs with the target in programming mode, the watchdog interrupt switches off VCC and 12 V at once,
+ * stores the state of the programming sequence in a .noinit record and lets the watchdog reset the Nano 16 ms later.
+ * setup() then reports the timeout and continues a running batch with this chip counted as failed.
+ * Requires a bootloader, which starts the sketch directly after a watchdog reset, like optiboot.
+ */
+#if !defined(DISABLE_WATCHDOG) && defined(__AVR__) && !defined(HVSP_EXTERNAL_PIN_IO)
+#define HV_WATCHDOG
+#define WATCHDOG_PRESCALER (_BV(WDP2) | _BV(WDP0)) // 0.5 s, the longest frame wait is 20 ms
+#define WATCHDOG_MAGIC 0x5744
+struct WatchdogRecord {
+    uint16_t Magic; // WATCHDOG_MAGIC if written by the watchdog interrupt
+    uint8_t State; // of sSequence at the timeout
+    char Command;
+    bool IsBatchMode;
+    uint16_t NumberOfPassed;
+    uint16_t NumberOfFailed;
+    const DeviceInfo *DevicePGM; // Of the aborted cycle
+    uint32_t CycleMillis;
+};
+WatchdogRecord sWatchdogRecord __attribute__((section(".noinit"))); // Survives the reset, valid only after a watchdog reset
+
+/*
+ * Optiboot clears MCUSR and passes its value in r2, which is saved here before the C runtime starts.
+ * Other bootloaders leave MCUSR unchanged.
+ */
+uint8_t sBootloaderResetFlags __attribute__((section(".noinit")));
+void saveBootloaderResetFlags() __attribute__((naked, used, section(".init0")));
+void saveBootloaderResetFlags() {
+    __asm__ __volatile__ ("sts %0, r2" : "=m" (sBootloaderResetFlags));
+}
+#endif
+
+uint8_t sPowerUpTimingIndex = POWER_UP_TIMING_INDEX; // Kept after a successful retry
+uint8_t sNumberOfPowerUpRetries;
+
+uint8_t sHVSPStatus = HVSP_OK; // Sticky, once set no more frames are shifted until resetHVSPStatus() is called
+uint16_t sReadyTimeoutMicros = HVSP_READY_TIMEOUT_READ_MICROS; // Timeout for the next wait for SDO high
+void (*sTargetBusyCallback)() = NULL; // Called repeatedly while waiting for the target to get ready and while loading a flash page
+
+/*
+ * Optional instrumentation, enabled by defining HVSP_INSTRUMENTATION.
+ * Each frame, each wait for ready and each high level operation stores its start and duration in micros() into a ring buffer,
+ * which can be fetched by OPCODE_READ_TRACE after the run. Storing an entry takes only a few microseconds and nothing is printed.
+ * micros() is used instead of timer 1 ticks, since timer 1 may be used for the SCI clock. Its resolution is 4 us at 16 MHz.
+ */
+#define TRACE_EVENT_FRAME 1 // Value is the SII value of the frame
+#define TRACE_EVENT_READY_WAIT 2 // Value is sHVSPStatus after the wait
+#define TRACE_EVENT_READ_SIGNATURE 3
+#define TRACE_EVENT_READ_FUSES 4
+#define TRACE_EVENT_READ_FUSE 5 // Value is the fuse index
+#define TRACE_EVENT_WRITE_FUSE 6 // Value is the fuse value
+
+#if defined(HVSP_INSTRUMENTATION)
+#define TRACE_BUFFER_SIZE 32 // Must be a power of 2
+struct TraceEntry {
+    uint16_t StartMicros; // Lower 16 bit of micros()
+    uint16_t DurationMicros; // 0xFFFF for longer durations
+    uint8_t Event;
+    uint8_t Value;
+};
+TraceEntry sTraceBuffer[TRACE_BUFFER_SIZE];
+uint8_t sTraceWriteIndex; // Index of the next entry to write
+uint8_t sTraceLength; // Number of available entries, the oldest ones are overwritten if the buffer is full
+
+void storeTraceEntry(uint8_t aEvent, uint8_t aValue, uint32_t aStartMicros);
+#define TRACE_START() uint32_t tTraceStartMicros = micros()
+#define TRACE_END(aEvent, aValue) storeTraceEntry(aEvent, aValue, tTraceStartMicros)
+#else
+#define TRACE_START()
+#define TRACE_END(aEvent, aValue)
+#endif
+
+/*
+ * Running counters of the session since reset or OPCODE_CLEAR_STATISTICS, fetched as a whole by OPCODE_READ_STATISTICS.
+ * A cycle is one run of the programming sequence, started by button, text command or batch mode. Mean cycle time is
+ * SumOfCycleMillis / NumberOfCycles. Bytes and timeouts are also counted for the commands of the binary protocol.
+ * A rising number of timeouts or cycle time at the same part signals a degrading fixture.
+ * The first STATISTICS_SIGNATURES different signatures get their own pass and fail counters.
+ */
+#define STATISTICS_SIGNATURES 4
+#define STATISTICS_TIMEOUT_READ 0
+#define STATISTICS_TIMEOUT_WRITE 1 // Fuse, lock bits, flash page and EEPROM
+#define STATISTICS_TIMEOUT_ERASE 2
+#define STATISTICS_TIMEOUT_WATCHDOG 3 // Hang of the sketch, see HV_WATCHDOG
+#define NUMBER_OF_STATISTICS_TIMEOUTS 4
+struct SignatureStatistics {
+    uint16_t Signature; // 0 for an unused entry
+    uint16_t NumberOfPassed;
+    uint16_t NumberOfFailed;
+};
+struct Statistics {
+    uint16_t NumberOfCycles;
+    uint16_t NumberOfPassed;
+    uint16_t NumberOfFailed;
+    uint32_t SumOfCycleMillis;
+    uint16_t MaxCycleMillis;
+    uint16_t NumberOfTimeouts[NUMBER_OF_STATISTICS_TIMEOUTS];
+    uint32_t NumberOfProgrammedBytes; // Flash and EEPROM bytes written, blank flash pages are not written
+    uint32_t NumberOfVerifiedBytes; // Flash bytes read for CRC and EEPROM bytes compared by 'k'
+    SignatureStatistics Signatures[STATISTICS_SIGNATURES];
+};
+#if defined(HV_WATCHDOG)
+Statistics sStatistics __attribute__((section(".noinit"))); // Survives a watchdog reset, cleared by setup() at all other resets
+#else
+Statistics sStatistics;
+#endif
+Statistics sStatisticsEEPROM EEMEM; // Snapshot, all bytes 0xFF if never saved
+
+void countCycle(const DeviceInfo *aDevicePGM, bool aSuccess, uint32_t aCycleMillis);
+void countTimeout(uint16_t aTimeoutMicros);
+
+void resetHVSPStatus();
+void expectTargetBusy(uint16_t aTimeoutMicros);
+bool waitForTargetReady();
+bool handleReadyTimeout(uint16_t aTimeoutMicros);
+uint8_t executeHVSPSequence(const HVSPFrame *aSequencePGM, uint8_t aNumberOfFrames, const uint8_t *aArguments, uint8_t *aResultBuffer);
 unsigned int readSignature();
-void writeFuse(unsigned int fuse, byte val);
-void readFuses();
+bool writeFuseValue(uint16_t aFuseAddress, uint8_t aValue);
+bool readFuses(uint8_t *aFuses);
+uint8_t readFuse(uint8_t aFuseIndex);
+void printIdentifyResult();
+const DeviceInfo* findDevice(unsigned int aSignature);
+void printFuseStatus(uint8_t aNumberOfFuses, const char *aFuseStatus);
+void runProgrammingSequence();
+void startProgrammingSequence(char aCommand);
+void startWaitForTargetReady(uint8_t aNextState);
+void finishDirectCommand(bool aSuccess);
+void finishProgrammingSequence();
+bool isStopRequested();
+void stopBatchMode();
+const DeviceInfo* pollForDevice();
+void sampleStartButton();
+void collectCommandLine();
+#if !defined(HVSP_MINIMAL)
+void logEvent(uint8_t aEvent, uint8_t aData0 = 0, uint8_t aData1 = 0, uint8_t aData2 = 0);
+void flushLog();
+#endif
+bool handleFuseProfileCommand(char *aCommandLine);
+void printFuseProfile(uint8_t aIndex);
+void selectFuseProfile(uint8_t aIndex);
+void selectNextFuseProfile();
+#if defined(HVSP_GANG)
+void storeGangSignatures(uint16_t aSignature);
+void storeGangFuses();
+bool isGangFuseDifferent(uint8_t aFuseIndex, uint8_t aValue);
+void setGangFuseStatus(uint8_t aFuseIndex, bool aIsWritten);
+void printGangReport();
+#endif
+void dumpMemory(uint16_t aSize, bool aBinary, bool aIsEEPROM);
+bool readFlashBytes(uint16_t aAddress, uint8_t aLength, uint8_t *aBuffer);
+uint32_t updateCRC32(uint32_t aCRC, uint8_t aByte);
+uint32_t computeFlashCRC32(uint16_t aAddress, uint16_t aLength);
+bool writeFlashPage(uint16_t aPageAddress, const uint8_t *aData, uint8_t aPageSize);
+bool readEEPROMBytes(uint16_t aAddress, uint8_t aLength, uint8_t *aBuffer);
+bool writeEEPROMBytes(uint16_t aAddress, uint8_t aLength, const uint8_t *aData, uint8_t aPageSize);
+bool writeEEPROMPage(uint16_t aAddress, uint8_t aLength, const uint8_t *aData);
+bool eraseChip();
+void programFlash(uint16_t aFlashSize, uint8_t aPageSize);
+uint8_t parseIntelHexCharacter(char aCharacter);
+void receiveHexCharacters();
+bool storeFlashByte(uint16_t aAddress, uint8_t aData);
+void queueFillPage();
+void writeQueuedFlashPage();
+bool isBlank(const uint8_t *aData, uint8_t aLength);
+bool blankCheckFlash(uint16_t aFlashSize, uint16_t *aFirstNonBlankAddress);
+void printHexByte(uint8_t aByte);
+void printIntelHexRecord(uint16_t aAddress, uint8_t aRecordType, const uint8_t *aData, uint8_t aLength);
+void enterHVProgrammingMode();
+void exitHVProgrammingMode();
+#if defined(HV_WATCHDOG)
+void armWatchdog();
+void recoverFromWatchdogTimeout();
+#endif
+void handleBinaryFrame();
+bool readFrameByte(uint8_t *aByte);
+void skipToNextFrame();
+uint8_t executeBinaryCommand(uint8_t aOpcode, const uint8_t *aPayload, uint8_t aLength, uint8_t *aResponseData, uint8_t *aResponseLength);
+void sendResponseFrame(uint8_t aSequenceNumber, uint8_t aOpcode, uint8_t aStatus, uint8_t aLength);
+#if defined(HVPP_ENGINE)
+byte parallelOut(byte aData, byte aInstruction);
+#define FRAME_ENGINE parallelOut
+#else
+byte shiftOut(byte val1, byte val2);
+#define FRAME_ENGINE shiftOut
+#endif
+#if defined(SCI_AUTO_TUNE)
+void setSCIRate(uint8_t aIndex);
+bool isSCIRateStable(unsigned int aReferenceSignature, uint8_t *aReferenceFuses);
+void autoTuneSCIRate();
+#endif
+
+/*
+ * Benchmark of the HVSP engines, enabled by defining HVSP_BENCHMARK and started by 'm'.
+ * The compiled engine of shiftOut() is compared with a digitalWrite() reference engine.
+ * Timer and port engine are exclusive at compile time, so compare them by running the benchmark with and without HVSP_TIMER_SCI.
+ * Output lines are "BENCH <engine> <metric> <value> <unit>", to be compared with the results of previous versions.
+ * Flash and EEPROM are only read, fuses and EEPROM are written with their current values.
+ */
+#if defined(HVSP_BENCHMARK)
+#define BENCHMARK_FRAMES 1000
+#define BENCHMARK_REPETITIONS 100
+#define BENCHMARK_WRITE_REPETITIONS 10
+#define BENCHMARK_CHUNK_SIZE 16
+#if defined(HVPP_ENGINE)
+#define COMPILED_ENGINE_NAME "parallel"
+#elif defined(HVSP_TIMER_SCI_ENGINE)
+#define COMPILED_ENGINE_NAME "timer"
+#elif defined(HVSP_PORT_IO)
+#define COMPILED_ENGINE_NAME "port"
+#else
+#define COMPILED_ENGINE_NAME "digitalWrite"
+#endif
+byte (*sShiftOutFunction)(byte, byte) = &FRAME_ENGINE; // Engine used by executeHVSPSequence()
+#define SHIFT_OUT(aSDIValue, aSIIValue) sShiftOutFunction(aSDIValue, aSIIValue)
+
+byte shiftOutDigitalWrite(byte val1, byte val2);
+void runBenchmark(const DeviceInfo *aDevicePGM);
+void runBenchmarkForEngine(const __FlashStringHelper *aEngineName, const DeviceInfo *aDevicePGM);
+#else
+#define SHIFT_OUT(aSDIValue, aSIIValue) FRAME_ENGINE(aSDIValue, aSIIValue)
+#endif
 
 void setup() {
+#if defined(HV_WATCHDOG)
+    uint8_t tResetFlags = MCUSR | sBootloaderResetFlags;
+    // A watchdog reset leaves the watchdog enabled with 16 ms timeout, and it can only be disabled after clearing WDRF
+    MCUSR = 0;
+    wdt_disable();
+    if (!(tResetFlags & _BV(WDRF)) || (tResetFlags & (_BV(PORF) | _BV(BORF)))) {
+        sWatchdogRecord.Magic = 0; // RAM content of a power on or brown out reset may match the magic by chance
+    }
+#endif
     Serial.begin(SERIAL_BAUDRATE);
     while (!Serial); //delay for Leonardo
     // Just to know which program is running on my Arduino
@@ -64,173 +999,2502 @@ void setup() {
 
     pinMode(VCC, OUTPUT);
     pinMode(RST, OUTPUT);
+#if defined(HVPP_ENGINE)
+    pinMode(XTAL1, OUTPUT);
+    pinMode(OE, OUTPUT);
+    pinMode(WR, OUTPUT);
+    pinMode(BS1, OUTPUT);
+    pinMode(PAGEL, OUTPUT);
+    pinMode(XA0, OUTPUT);
+    pinMode(XA1, OUTPUT);
+    pinMode(BS2, OUTPUT);
+    // Data bus is output and low while not reading. The analog comparator compares A6 or A7 with the bandgap
+    DDRB |= HVPP_DATA_LOW_MASK;
+    DDRC |= HVPP_DATA_HIGH_MASK;
+    ADCSRA &= ~_BV(ADEN);
+    ADCSRB = _BV(ACME);
+    ADMUX = HVPP_RDY_MUX;
+    ACSR = _BV(ACBG);
+#else
     pinMode(SDI, OUTPUT);
     pinMode(SII, OUTPUT);
     pinMode(SCI, OUTPUT);
     pinMode(SDO, OUTPUT); // Configured as input when in programming mode
+#endif
     digitalWrite(RST, HIGH); // Level shifter is inverting, this shuts off 12V
+#if defined(HV_WATCHDOG)
+    if (sWatchdogRecord.Magic != WATCHDOG_MAGIC) { // No start blink after a watchdog timeout, to be ready again at once
+        memset(&sStatistics, 0, sizeof(sStatistics));
+        digitalWrite(LED_BUILTIN, HIGH);
+        delay(500);
+        digitalWrite(LED_BUILTIN, LOW);
+    }
+#else
+    memset(&sStatistics, 0, sizeof(sStatistics));
     digitalWrite(LED_BUILTIN, HIGH);
     delay(500);
     digitalWrite(LED_BUILTIN, LOW);
+#endif
 
-    Serial.println("Press button at pin 6 to start process or enter any character to start process...");
+#if !defined(HVPP_ENGINE)
     pinMode(START_BUTTON_PIN, INPUT_PULLUP);
+#endif
+#if defined(HVSP_MINIMAL)
+    Serial.println(F("Press button at pin " START_BUTTON_PIN_NAME " to start process. Only the binary host protocol is available."));
+#else
+    Serial.println(F("Press button at pin " START_BUTTON_PIN_NAME " to start process or enter any character to start process..."));
+    Serial.println(F("Enter 'd' to dump flash as Intel HEX or 'b' to dump flash as binary."));
+    Serial.println(F("Enter 'p' to erase chip and program flash with an Intel HEX file sent afterwards."));
+    Serial.println(F("Enter 'e' to erase chip, which clears the lock bits, and restore the default fuses."));
+    Serial.println(F("Enter 'f' to write all default fuses, even if they are already set."));
+    Serial.println(F("Enter 'c' for continuous batch recovery of one chip after the other."));
+#if defined(HVSP_BENCHMARK)
+    Serial.println(F("Enter 'm' to measure the speed of the HVSP engines."));
+#endif
+    Serial.println(F("Enter 'n' to check if flash is blank."));
+#if defined(SCI_AUTO_TUNE)
+    Serial.println(F("Enter 't' to find and store the fastest stable SCI clock rate for the connected fixture."));
+#endif
+    Serial.println(F("Enter 'i' to print signature, calibration bytes, fuses and lock bits read in one pass."));
+    Serial.println(F("Enter 'r' to dump EEPROM as Intel HEX or 'k' to erase chip and restore fuses, keeping the EEPROM content."));
+    Serial.println(F("Enter 'l' to list, 's<n> <signature> <name> <L> <H> <E>' to store, 'x<n>' to delete and 'u<n>' to use a fuse profile."));
+    Serial.println(F("'u' without number or long press of the button cycle through the profiles and the defaults."));
+#endif
+
+    sSelectedFuseProfile = eeprom_read_byte(&sSelectedFuseProfileEEPROM);
+    if (sSelectedFuseProfile >= MAX_FUSE_PROFILES) {
+        sSelectedFuseProfile = NO_FUSE_PROFILE;
+#if !defined(HVSP_MINIMAL)
+    } else {
+        Serial.print(F("Selected "));
+        printFuseProfile(sSelectedFuseProfile);
+#endif
+    }
+#if defined(SCI_AUTO_TUNE)
+    uint8_t tSCIRateIndex = eeprom_read_byte(&sSCIRateIndexEEPROM);
+    if (tSCIRateIndex < NUMBER_OF_SCI_RATES) {
+        setSCIRate(tSCIRateIndex);
+        Serial.print(F("Using tuned SCI rate "));
+        Serial.println(tSCIRateIndex);
+    }
+#endif
+
+#if defined(TIMSK2)
+    // 1 ms tick by timer 2 in CTC mode for button debouncing
+    TCCR2A = _BV(WGM21);
+    TCCR2B = _BV(CS22); // Prescaler 64
+    OCR2A = (F_CPU / 64 / 1000) - 1;
+    TIMSK2 = _BV(OCIE2A);
+#endif
+#if defined(HV_WATCHDOG)
+    if (sWatchdogRecord.Magic == WATCHDOG_MAGIC) {
+        recoverFromWatchdogTimeout();
+    }
+#endif
+}
+
+#if defined(TIMSK2)
+ISR(TIMER2_COMPA_vect) {
+    sampleStartButton();
+}
+#endif
+
+/*
+ * Called every millisecond
+ */
+void sampleStartButton() {
+#if defined(HVPP_ENGINE)
+    /*
+     * Switch the comparator to A7 and back. The settle time after switching back ensures,
+     * that a ready check in the interrupted code sees the comparator output for RDY/BSY again.
+     */
+    ADMUX = HVPP_BUTTON_MUX;
+    __builtin_avr_delay_cycles(HVPP_COMPARATOR_SETTLE_CYCLES);
+    bool tIsDown = (ACSR & _BV(ACO)); // Below bandgap voltage
+    ADMUX = HVPP_RDY_MUX;
+    __builtin_avr_delay_cycles(HVPP_COMPARATOR_SETTLE_CYCLES);
+#else
+    bool tIsDown = !fastDigitalRead(START_BUTTON_PIN);
+#endif
+    if (tIsDown == sButtonIsDown) {
+        sButtonStableTicks = 0;
+        if (tIsDown && sButtonDownMillis < BUTTON_LONG_PRESS_MILLIS) {
+            sButtonDownMillis++;
+        }
+    } else if (++sButtonStableTicks >= BUTTON_DEBOUNCE_MILLIS) {
+        sButtonIsDown = tIsDown;
+        sButtonStableTicks = 0;
+        if (tIsDown) {
+            sButtonDownMillis = 0;
+        } else if (sButtonDownMillis >= BUTTON_LONG_PRESS_MILLIS) {
+            sButtonLongPressEvent = true;
+        } else {
+            sButtonPressedEvent = true;
+        }
+    }
 }
 
 void loop() {
-    if (!digitalRead(START_BUTTON_PIN) || Serial.available() > 0) {
-        delay(100); // debouncing wait for serial buffer to be filled (eg. with CR/LF)
-        while (Serial.available() > 0) {
-            Serial.read();
+#if !defined(TIMSK2)
+    static uint32_t sLastButtonSampleMillis;
+    if (millis() != sLastButtonSampleMillis) {
+        sLastButtonSampleMillis = millis();
+        sampleStartButton();
+    }
+#endif
+#if defined(HV_WATCHDOG)
+    wdt_reset();
+#endif
+    runProgrammingSequence();
+}
+
+/*
+ * Execute current state of the programming sequence
+ */
+void runProgrammingSequence() {
+    if (sSequence.State == STATE_IDLE || sSequence.State == STATE_BATCH_WAIT_FOR_INSERTION
+            || sSequence.State == STATE_BATCH_WAIT_FOR_REMOVAL) {
+        flushLog();
+    }
+    switch (sSequence.State) {
+    case STATE_IDLE:
+        if (sSequence.BlinkLED) {
+            digitalWrite(LED_BUILTIN, (millis() % 200) >= 150); // Blink after end of programming
         }
-        digitalWrite(LED_BUILTIN, HIGH);
-        pinMode(SDO, OUTPUT); // Set SDO to output
-        digitalWrite(SDI, LOW);
-        digitalWrite(SII, LOW);
-        digitalWrite(SDO, LOW);
-        digitalWrite(RST, HIGH); // 12v Off
-        digitalWrite(VCC, HIGH); // Vcc On
-        delayMicroseconds(20);
-        digitalWrite(RST, LOW); // 12v On
-        delayMicroseconds(10);
-        pinMode(SDO, INPUT); // Set SDO to input
-        delayMicroseconds(300);
-        Serial.println("Reading signature from connected ATtiny...");
+        if (Serial.available() > 0) {
+            if (Serial.peek() == FRAME_SYNC) {
+                handleBinaryFrame();
+            } else {
+#if defined(HVSP_MINIMAL)
+                Serial.read(); // No text commands
+#else
+                sSequence.DeadlineMillis = millis() + COMMAND_COLLECT_MILLIS;
+                sSequence.State = STATE_COLLECT_COMMAND;
+#endif
+            }
+        } else if (sButtonPressedEvent) {
+            sButtonPressedEvent = false;
+            startProgrammingSequence(0);
+#if !defined(HVSP_MINIMAL)
+        } else if (sButtonLongPressEvent) {
+            sButtonLongPressEvent = false;
+            selectNextFuseProfile();
+#endif
+        }
+        break;
+
+#if !defined(HVSP_MINIMAL)
+
+    case STATE_COLLECT_COMMAND:
+        if ((int32_t) (millis() - sSequence.DeadlineMillis) >= 0) {
+            collectCommandLine();
+            char tCommand = sCommandLine[0];
+            if (handleFuseProfileCommand(sCommandLine)) {
+                sSequence.State = STATE_IDLE;
+            } else if (tCommand == 'c') {
+                Serial.println(F("Batch mode started. Insert chips one after the other. Send a character or press button to stop."));
+                sSequence.IsBatchMode = true;
+                sSequence.BlinkLED = false;
+                digitalWrite(LED_BUILTIN, LOW);
+                sSequence.NumberOfPassed = 0;
+                sSequence.NumberOfFailed = 0;
+                sSequence.StablePolls = 0;
+                sButtonPressedEvent = false;
+                sSequence.State = STATE_BATCH_WAIT_FOR_INSERTION;
+            } else {
+                startProgrammingSequence(tCommand);
+            }
+        }
+        break;
+#endif
+
+    case STATE_POWER_UP:
+        // Deadline is in the future only before a retry
+        if ((int32_t) (millis() - sSequence.DeadlineMillis) >= 0) {
+            enterHVProgrammingMode();
+            sSequence.State = STATE_IDENTIFY;
+        }
+        break;
+
+    case STATE_IDENTIFY: {
+        logEvent(LOG_READING_SIGNATURE);
         unsigned int sig = readSignature();
-        Serial.println("Reading complete..");
-        Serial.print("Signature is: ");
-        Serial.println(sig, HEX);
-        readFuses();
-        if (sig == ATTINY13) {
-
-            Serial.println("The ATtiny is detected as ATtiny13/ATtiny13A.");
-            Serial.println("Write LFUSE: 0x6A");
-            writeFuse(LFUSE, 0x6A);
-            Serial.println("Write HFUSE: 0xFF");
-            writeFuse(HFUSE, 0xFF);
-            Serial.println("");
-        } else if (sig == ATTINY24 || sig == ATTINY44 || sig == ATTINY84 || sig == ATTINY25 || sig == ATTINY45 || sig == ATTINY85) {
-
-            Serial.print("The ATtiny is detected as ");
-            if (sig == ATTINY24)
-                Serial.println("ATTINY24.");
-            else if (sig == ATTINY44)
-                Serial.println("ATTINY44.");
-            else if (sig == ATTINY84)
-                Serial.println("ATTINY84.");
-            else if (sig == ATTINY25)
-                Serial.println("ATTINY25.");
-            else if (sig == ATTINY45)
-                Serial.println("ATTINY45.");
-            else if (sig == ATTINY85)
-                Serial.println("ATTINY85.");
-
-            Serial.println("Write LFUSE: 0x62");
-            writeFuse(LFUSE, 0x62);
-            Serial.println("Write HFUSE: 0xDF");
-            writeFuse(HFUSE, 0xDF);
-            Serial.println("Write EFUSE: 0xFF");
-            writeFuse(EFUSE, 0xFF);
-        } else {
-            //Wait for button to release
-            while (!digitalRead(START_BUTTON_PIN))
-                ;
-            delay(100); // debouncing
-            Serial.println("No valid ATtiny signature detected! Try again.");
-            // try again
-            return;
+#if defined(HVSP_GANG)
+        storeGangSignatures(sig);
+#endif
+#if defined(POWER_UP_RETRY)
+        if ((sig == 0x0000 || sig == 0xFFFF) && sNumberOfPowerUpRetries < NUMBER_OF_POWER_UP_TIMINGS - 1) {
+            // Power down and try again with the next, more relaxed timing
+            exitHVProgrammingMode();
+            sNumberOfPowerUpRetries++;
+            sPowerUpTimingIndex = (sPowerUpTimingIndex + 1) % NUMBER_OF_POWER_UP_TIMINGS;
+            logEvent(LOG_POWER_UP_RETRY, sPowerUpTimingIndex);
+            sSequence.DeadlineMillis = millis() + POWER_DOWN_MILLIS;
+            sSequence.State = STATE_POWER_UP;
+            break;
+        }
+        if (sig == 0x0000 || sig == 0xFFFF) {
+            sPowerUpTimingIndex = POWER_UP_TIMING_INDEX; // No profile was successful
+        }
+#endif
+        if (sHVSPStatus != HVSP_OK) {
+            logEvent(LOG_READY_TIMEOUT);
+        } else {
+            logEvent(LOG_SIGNATURE, sig >> 8, sig);
+            readFuses(sSequence.Fuses);
+#if defined(HVSP_GANG)
+            storeGangFuses();
+#endif
+        }
+        const DeviceInfo *tDevicePGM = NULL;
+        if (sHVSPStatus == HVSP_OK) {
+            tDevicePGM = findDevice(sig);
+        }
+        if (tDevicePGM != NULL) {
+            logEvent(LOG_DETECTED, tDevicePGM - DeviceTable);
+            if (!isDeviceSupported(tDevicePGM)) {
+                logEvent(LOG_WRONG_PROGRAMMING_MODE);
+                tDevicePGM = NULL;
+            }
+        }
+        sSequence.DevicePGM = tDevicePGM;
+#if defined(HVSP_BENCHMARK)
+        if (sSequence.Command == 'm' && tDevicePGM != NULL) {
+            flushLog();
+            runBenchmark(tDevicePGM);
+            finishDirectCommand(sHVSPStatus == HVSP_OK);
+            break;
+        }
+#endif
+#if !defined(HVSP_MINIMAL)
+#if defined(SCI_AUTO_TUNE)
+        if (sSequence.Command == 't' && tDevicePGM != NULL) {
+            flushLog();
+            autoTuneSCIRate();
+            finishDirectCommand(true); // Tuning ends by design with a failing rate
+            break;
+        }
+#endif
+        if (sSequence.Command == 'i') {
+            // Works also for unknown parts
+            flushLog();
+            printIdentifyResult();
+            finishDirectCommand(sHVSPStatus == HVSP_OK);
+            break;
+        }
+#endif
+        uint8_t tNumberOfFuses = 0;
+        if (tDevicePGM != NULL) {
+            tNumberOfFuses = pgm_read_byte(&tDevicePGM->NumberOfFuses);
+        }
+        memset(sSequence.FuseStatus, FUSE_STATUS_TIMEOUT, MAX_NUMBER_OF_FUSES);
+        if (tDevicePGM == NULL) {
+            logEvent(LOG_NO_VALID_SIGNATURE);
+            if (sSequence.IsBatchMode) {
+                sSequence.State = STATE_FINISH;
+            } else {
+                finishDirectCommand(false);
+            }
+            break;
         }
 
-        Serial.println("Fuses will be read again to check if it's changed successfully...");
-        readFuses();
-        digitalWrite(SCI, LOW);
-        digitalWrite(VCC, LOW); // Vcc Off
-        digitalWrite(RST, HIGH); // 12v Off
+        char tCommand = sSequence.Command;
+#if !defined(HVSP_MINIMAL)
+        if (tCommand == 'n') {
+            flushLog();
+            uint16_t tFirstNonBlankAddress;
+            if (blankCheckFlash(pgm_read_word(&tDevicePGM->FlashSize), &tFirstNonBlankAddress)) {
+                Serial.println(F("Flash is blank."));
+            } else if (sHVSPStatus == HVSP_OK) {
+                Serial.print(F("Flash is not blank at 0x"));
+                Serial.println(tFirstNonBlankAddress, HEX);
+            } else {
+                Serial.println(F("Timeout while reading flash."));
+            }
+            finishDirectCommand(sHVSPStatus == HVSP_OK);
+            break;
+        }
+        if (tCommand == 'd' || tCommand == 'b' || tCommand == 'r' || tCommand == 'p') {
+            // Streaming functions, which run until the whole memory is transferred
+            flushLog();
+            if (tCommand == 'p') {
+                programFlash(pgm_read_word(&tDevicePGM->FlashSize), pgm_read_byte(&tDevicePGM->FlashPageSize));
+            } else if (tCommand == 'r') {
+                dumpMemory(pgm_read_word(&tDevicePGM->EEPROMSize), false, true);
+            } else {
+                dumpMemory(pgm_read_word(&tDevicePGM->FlashSize), tCommand == 'b', false);
+            }
+            finishDirectCommand(sHVSPStatus == HVSP_OK && (tCommand != 'p' || sHexParseResult == HEX_PARSE_END_OF_FILE));
+            break;
+        }
+#endif
 
-        Serial.println("");
-        delay(1000);
-        digitalWrite(LED_BUILTIN, LOW);
-        delay(1000);
-        /*
-         * Blink forever after end of programming
-         */
-        while (true) {
-            delay(150);
-            digitalWrite(LED_BUILTIN, HIGH);
-            delay(50);
-            digitalWrite(LED_BUILTIN, LOW);
+        memcpy_P(sSequence.TargetFuses, tDevicePGM->DefaultFuses, tNumberOfFuses);
+        if (sSelectedFuseProfile != NO_FUSE_PROFILE) {
+            FuseProfile *tProfileEEPROM = &sFuseProfilesEEPROM[sSelectedFuseProfile];
+            if (eeprom_read_word(&tProfileEEPROM->Signature) == sig) {
+                eeprom_read_block(sSequence.TargetFuses, tProfileEEPROM->Fuses, tNumberOfFuses);
+                logEvent(LOG_USING_FUSE_PROFILE, sSelectedFuseProfile);
+            } else {
+                logEvent(LOG_FUSE_PROFILE_MISMATCH);
+            }
+        }
+        sSequence.FuseIndex = 0;
+        sSequence.EEPROMAddress = 0;
+        sSequence.EEPROMVerifyError = false;
+#if !defined(HVSP_MINIMAL)
+        if (tCommand == 'k') {
+            if (pgm_read_word(&tDevicePGM->EEPROMSize) > MAX_EEPROM_SIZE) {
+                logEvent(LOG_EEPROM_TOO_LARGE);
+                finishDirectCommand(false);
+                break;
+            }
+            logEvent(LOG_SAVING_EEPROM);
+            for (uint16_t tAddress = 0; tAddress < pgm_read_word(&tDevicePGM->EEPROMSize); tAddress += EEPROM_VERIFY_CHUNK_SIZE) {
+                readEEPROMBytes(tAddress, EEPROM_VERIFY_CHUNK_SIZE, &sEEPROMSnapshot[tAddress]);
+            }
         }
+#endif
+        if (tCommand == 'e' || tCommand == 'k') {
+            // Recover: erase followed by the (EEPROM and) fuse restore
+            logEvent(LOG_ERASING);
+            runHVSPSequence(ChipEraseSequence, NULL, NULL);
+            startWaitForTargetReady(tCommand == 'k' ? STATE_RESTORE_EEPROM : STATE_WRITE_FUSE);
+        } else {
+            sSequence.State = STATE_WRITE_FUSE;
+        }
+        break;
     }
-}
 
-byte shiftOut(byte val1, byte val2) {
-    int inBits = 0;
-    uint32_t tMillis = millis();
-    //Wait with timeout until SDO goes high
-    while (!digitalRead(SDO)) {
-        if (millis() > (tMillis + READING_TIMEOUT_MILLIS)) {
+    case STATE_WRITE_FUSE: {
+        uint8_t tIndex = sSequence.FuseIndex;
+        if (tIndex >= pgm_read_byte(&sSequence.DevicePGM->NumberOfFuses)) {
+            sSequence.State = STATE_FINISH;
             break;
         }
+        uint8_t tValue = sSequence.TargetFuses[tIndex];
+        bool tIsDifferent = (tValue != sSequence.Fuses[tIndex]);
+#if defined(HVSP_GANG)
+        tIsDifferent = tIsDifferent || isGangFuseDifferent(tIndex, tValue);
+#endif
+        if (tIsDifferent || sSequence.Command == 'f') {
+            logEvent(LOG_WRITE_FUSE, pgm_read_byte(&FuseNames[tIndex]), tValue);
+            uint16_t tAddress = pgm_read_word(&FuseWriteAddresses[tIndex]);
+            uint8_t tArguments[] = { tValue, (uint8_t) (tAddress >> 8), (uint8_t) tAddress };
+            runHVSPSequence(WriteFuseSequence, tArguments, NULL);
+            startWaitForTargetReady(STATE_VERIFY_FUSE);
+        } else {
+            sSequence.FuseStatus[tIndex] = FUSE_STATUS_UNCHANGED;
+#if defined(HVSP_GANG)
+            setGangFuseStatus(tIndex, false);
+#endif
+            sSequence.FuseIndex++;
+        }
+        break;
     }
-    unsigned int dout = (unsigned int) val1 << 2;
-    unsigned int iout = (unsigned int) val2 << 2;
-    for (int ii = 10; ii >= 0; ii--) {
-        digitalWrite(SDI, !!(dout & (1 << ii)));
-        digitalWrite(SII, !!(iout & (1 << ii)));
-        inBits <<= 1;
-        inBits |= digitalRead(SDO);
-        digitalWrite(SCI, HIGH);
-        digitalWrite(SCI, LOW);
+
+    case STATE_WAIT_FOR_READY:
+        if (isTargetReady()) {
+#if defined(HVSP_INSTRUMENTATION)
+            storeTraceEntry(TRACE_EVENT_READY_WAIT, HVSP_OK, sSequence.WaitStartMicros);
+#endif
+            sSequence.State = sSequence.NextState;
+        } else if (micros() - sSequence.WaitStartMicros > sSequence.WaitTimeoutMicros) {
+            if (handleReadyTimeout(sSequence.WaitTimeoutMicros)) {
+                sSequence.State = sSequence.NextState;
+            } else {
+                logEvent(LOG_READY_TIMEOUT);
+                sSequence.State = STATE_FINISH;
+            }
+        }
+        break;
+
+    case STATE_VERIFY_FUSE: {
+        uint8_t tIndex = sSequence.FuseIndex;
+        if (readFuse(tIndex) != sSequence.TargetFuses[tIndex]) {
+            sSequence.FuseStatus[tIndex] = FUSE_STATUS_VERIFY_ERROR;
+        } else {
+            sSequence.FuseStatus[tIndex] = FUSE_STATUS_WRITTEN;
+        }
+#if defined(HVSP_GANG)
+        setGangFuseStatus(tIndex, true);
+#endif
+        if (sHVSPStatus != HVSP_OK) {
+            sSequence.FuseStatus[tIndex] = FUSE_STATUS_TIMEOUT;
+            sSequence.State = STATE_FINISH;
+        } else {
+            sSequence.FuseIndex++;
+            sSequence.State = STATE_WRITE_FUSE;
+        }
+        break;
+    }
+
+#if !defined(HVSP_MINIMAL)
+    case STATE_RESTORE_EEPROM: {
+        uint16_t tAddress = sSequence.EEPROMAddress;
+        if (tAddress >= pgm_read_word(&sSequence.DevicePGM->EEPROMSize)) {
+            sSequence.EEPROMAddress = 0;
+            sSequence.State = STATE_VERIFY_EEPROM;
+            break;
+        }
+        uint8_t tPageSize = pgm_read_byte(&sSequence.DevicePGM->EEPROMPageSize);
+        sSequence.EEPROMAddress += tPageSize;
+        if (isBlank(&sEEPROMSnapshot[tAddress], tPageSize)) {
+            break; // Already erased by the chip erase, check next page at next call
+        }
+        writeEEPROMPage(tAddress, tPageSize, &sEEPROMSnapshot[tAddress]);
+        startWaitForTargetReady(STATE_RESTORE_EEPROM);
+        break;
+    }
+
+    case STATE_VERIFY_EEPROM: {
+        // One chunk per call
+        uint16_t tAddress = sSequence.EEPROMAddress;
+        if (tAddress >= pgm_read_word(&sSequence.DevicePGM->EEPROMSize)) {
+            if (sSequence.EEPROMVerifyError) {
+                logEvent(LOG_EEPROM_VERIFY_ERROR);
+            } else {
+                logEvent(LOG_EEPROM_RESTORED);
+            }
+            sSequence.State = STATE_WRITE_FUSE;
+            break;
+        }
+        uint8_t tChunk[EEPROM_VERIFY_CHUNK_SIZE];
+        if (readEEPROMBytes(tAddress, EEPROM_VERIFY_CHUNK_SIZE, tChunk)) {
+            sStatistics.NumberOfVerifiedBytes += EEPROM_VERIFY_CHUNK_SIZE;
+        }
+        if (memcmp(tChunk, &sEEPROMSnapshot[tAddress], EEPROM_VERIFY_CHUNK_SIZE) != 0) {
+            sSequence.EEPROMVerifyError = true;
+        }
+        sSequence.EEPROMAddress += EEPROM_VERIFY_CHUNK_SIZE;
+        if (sHVSPStatus != HVSP_OK) {
+            sSequence.State = STATE_FINISH;
+        }
+        break;
+    }
+#endif
+
+    case STATE_FINISH:
+        finishProgrammingSequence();
+        break;
+
+#if !defined(HVSP_MINIMAL)
+    case STATE_BATCH_WAIT_FOR_INSERTION:
+    case STATE_BATCH_WAIT_FOR_REMOVAL:
+        if (isStopRequested()) {
+            stopBatchMode();
+        } else if ((int32_t) (millis() - sSequence.DeadlineMillis) >= 0) {
+            sSequence.DeadlineMillis = millis() + BATCH_POLL_INTERVAL_MILLIS;
+            bool tIsInserted = (pollForDevice() != NULL);
+            if (tIsInserted == (sSequence.State == STATE_BATCH_WAIT_FOR_INSERTION)) {
+                sSequence.StablePolls++;
+            } else {
+                sSequence.StablePolls = 0;
+            }
+            if (sSequence.StablePolls >= BATCH_STABLE_POLLS) {
+                sSequence.StablePolls = 0;
+                if (sSequence.State == STATE_BATCH_WAIT_FOR_INSERTION) {
+                    Serial.print(F("Chip "));
+                    Serial.println(sSequence.NumberOfPassed + sSequence.NumberOfFailed + 1);
+                    startProgrammingSequence('e');
+                } else {
+                    Serial.println(F("Ready for next chip."));
+                    sSequence.State = STATE_BATCH_WAIT_FOR_INSERTION;
+                }
+            }
+        }
+        break;
+#endif
     }
-    return inBits >> 2;
 }
 
-void writeFuse(unsigned int fuse, byte val) {
+void startProgrammingSequence(char aCommand) {
+    sSequence.Command = aCommand;
+    sSequence.DeadlineMillis = millis();
+    sSequence.StartMillis = sSequence.DeadlineMillis;
+    sSequence.DevicePGM = NULL; // Until identified, no stale device of the last cycle for the statistics
+    sNumberOfPowerUpRetries = 0;
+    sSequence.BlinkLED = false;
+    digitalWrite(LED_BUILTIN, HIGH);
+    sSequence.State = STATE_POWER_UP;
+}
 
-    Serial.print("Writing fuse value ");
-    Serial.print(val, HEX);
-    Serial.println(" to ATtiny...");
+/*
+ * Wait for the command, which was just started, with the timeout it selected by expectTargetBusy()
+ */
+void startWaitForTargetReady(uint8_t aNextState) {
+    sSequence.WaitTimeoutMicros = sReadyTimeoutMicros;
+    sReadyTimeoutMicros = HVSP_READY_TIMEOUT_READ_MICROS;
+    sSequence.WaitStartMicros = micros();
+    sSequence.NextState = aNextState;
+    sSequence.State = STATE_WAIT_FOR_READY;
+}
 
-    shiftOut(0x40, 0x4C);
-    shiftOut(val, 0x2C);
-    shiftOut(0x00, (byte) (fuse >> 8));
-    shiftOut(0x00, (byte) fuse);
+/*
+ * End of a run which is not continued by the fuse states, like a dump, or which found no valid part
+ */
+void finishDirectCommand(bool aSuccess) {
+    countCycle(sSequence.DevicePGM, aSuccess, millis() - sSequence.StartMillis);
+    exitHVProgrammingMode();
+    digitalWrite(LED_BUILTIN, LOW);
+    sSequence.State = STATE_IDLE;
+}
 
-    Serial.println("Writing complete.");
+void finishProgrammingSequence() {
+    exitHVProgrammingMode();
+    flushLog();
+    bool tSuccess = (sHVSPStatus == HVSP_OK && sSequence.DevicePGM != NULL && !sSequence.EEPROMVerifyError);
+    if (sSequence.DevicePGM != NULL) {
+        uint8_t tNumberOfFuses = pgm_read_byte(&sSequence.DevicePGM->NumberOfFuses);
+        printFuseStatus(tNumberOfFuses, sSequence.FuseStatus);
+#if defined(HVSP_GANG)
+        printGangReport();
+#endif
+        for (uint8_t i = 0; i < tNumberOfFuses; ++i) {
+            if (sSequence.FuseStatus[i] != FUSE_STATUS_UNCHANGED && sSequence.FuseStatus[i] != FUSE_STATUS_WRITTEN) {
+                tSuccess = false;
+            }
+        }
+    }
+    countCycle(sSequence.DevicePGM, tSuccess, millis() - sSequence.StartMillis);
+    if (sSequence.IsBatchMode) {
+        if (tSuccess) {
+            sSequence.NumberOfPassed++;
+            Serial.println(F("PASS"));
+        } else {
+            sSequence.NumberOfFailed++;
+            Serial.println(F("FAIL"));
+        }
+        digitalWrite(LED_BUILTIN, LOW);
+        sSequence.DeadlineMillis = millis() + BATCH_POLL_INTERVAL_MILLIS;
+        sSequence.State = STATE_BATCH_WAIT_FOR_REMOVAL;
+    } else {
+        Serial.println();
+        sSequence.BlinkLED = true;
+        sSequence.State = STATE_IDLE;
+    }
 }
 
-void readFuses() {
+/*
+ * @return true if a character was received or the button was pressed. Consumes all received characters.
+ */
+bool isStopRequested() {
+    if (Serial.available() > 0) {
+        while (Serial.available() > 0) {
+            Serial.read();
+        }
+        return true;
+    }
+    if (sButtonPressedEvent) {
+        sButtonPressedEvent = false;
+        return true;
+    }
+    return false;
+}
 
-    Serial.println("Reading fuse settings from ATtiny...");
+void stopBatchMode() {
+    Serial.print(F("Batch mode stopped. Passed: "));
+    Serial.print(sSequence.NumberOfPassed);
+    Serial.print(F(" Failed: "));
+    Serial.println(sSequence.NumberOfFailed);
+    sSequence.IsBatchMode = false;
+    sSequence.State = STATE_IDLE;
+}
 
-    byte val;
-    shiftOut(0x04, 0x4C); // LFuse
-    shiftOut(0x00, 0x68);
-    val = shiftOut(0x00, 0x6C);
-    Serial.print("LFuse: ");
-    Serial.print(val, HEX);
-    shiftOut(0x04, 0x4C); // HFuse
-    shiftOut(0x00, 0x7A);
-    val = shiftOut(0x00, 0x7E);
-    Serial.print(", HFuse: ");
-    Serial.print(val, HEX);
-    shiftOut(0x04, 0x4C); // EFuse
-    shiftOut(0x00, 0x6A);
-    val = shiftOut(0x00, 0x6E);
-    Serial.print(", EFuse: ");
-    Serial.println(val, HEX);
-    Serial.println("Reading complete.");
+/*
+ * Copy the received line without CR/LF to sCommandLine and discard the rest
+ */
+void collectCommandLine() {
+    uint8_t tLength = 0;
+    while (Serial.available() > 0) {
+        char tCharacter = Serial.read();
+        if (tCharacter == '\r' || tCharacter == '\n') {
+            break;
+        }
+        if (tLength < COMMAND_LINE_SIZE - 1) {
+            sCommandLine[tLength++] = tCharacter;
+        }
+    }
+    sCommandLine[tLength] = '\0';
+    while (Serial.available() > 0) {
+        Serial.read();
+    }
 }
 
-unsigned int readSignature() {
-    unsigned int sig = 0;
-    byte val;
-    for (int ii = 1; ii < 3; ii++) {
-        shiftOut(0x08, 0x4C);
-        shiftOut(ii, 0x0C);
-        shiftOut(0x00, 0x68);
-        val = shiftOut(0x00, 0x6C);
-        sig = (sig << 8) + val;
-    }
-    return sig;
+/*
+ * Handle the fuse profile commands, which do not require a target
+ * @return false if aCommandLine is not a fuse profile command
+ */
+bool handleFuseProfileCommand(char *aCommandLine) {
+    char tCommand = aCommandLine[0];
+    if (tCommand != 'l' && tCommand != 's' && tCommand != 'x' && tCommand != 'u') {
+        return false;
+    }
+    char *tToken = strtok(&aCommandLine[1], " ");
+    if (tCommand == 'u' && tToken == NULL) {
+        selectNextFuseProfile();
+        return true;
+    }
+    if (tCommand == 'l') {
+        for (uint8_t i = 0; i < MAX_FUSE_PROFILES; ++i) {
+            if (eeprom_read_word(&sFuseProfilesEEPROM[i].Signature) != FUSE_PROFILE_EMPTY) {
+                if (i == sSelectedFuseProfile) {
+                    Serial.print('*');
+                }
+                printFuseProfile(i);
+            }
+        }
+        return true;
+    }
+    // s, x and u with argument require an explicit number, a missing one must not select profile 0
+    if (tToken == NULL) {
+        Serial.println(F("Missing profile number."));
+        return true;
+    }
+    char *tEnd;
+    unsigned long tNumber = strtoul(tToken, &tEnd, 10);
+    if (tEnd == tToken || *tEnd != '\0' || tNumber >= MAX_FUSE_PROFILES) {
+        Serial.println(F("Invalid profile number."));
+        return true;
+    }
+    uint8_t tIndex = tNumber;
+    if (tCommand == 'u') {
+        selectFuseProfile(tIndex);
+    } else if (tCommand == 'x') {
+        eeprom_update_word(&sFuseProfilesEEPROM[tIndex].Signature, FUSE_PROFILE_EMPTY);
+        if (tIndex == sSelectedFuseProfile) {
+            selectFuseProfile(NO_FUSE_PROFILE);
+        }
+        Serial.println(F("Profile deleted."));
+    } else {
+        // s<n> <signature> <name> <L> <H> <E>, all values hex, E may be omitted for parts with 2 fuses
+        FuseProfile tProfile;
+        memset(&tProfile, 0, sizeof(tProfile));
+        tProfile.Fuses[EFUSE_INDEX] = 0xFF;
+        char *tSignatureToken = strtok(NULL, " ");
+        char *tNameToken = strtok(NULL, " ");
+        if (tNameToken == NULL) {
+            Serial.println(F("Missing signature or name."));
+            return true;
+        }
+        tProfile.Signature = strtoul(tSignatureToken, NULL, 16);
+        strncpy(tProfile.Name, tNameToken, FUSE_PROFILE_NAME_SIZE - 1);
+        uint8_t tNumberOfFuses = 0;
+        while (tNumberOfFuses < MAX_NUMBER_OF_FUSES && (tToken = strtok(NULL, " ")) != NULL) {
+            tProfile.Fuses[tNumberOfFuses++] = strtoul(tToken, NULL, 16);
+        }
+        if (tNumberOfFuses < 2 || findDevice(tProfile.Signature) == NULL) {
+            Serial.println(F("Unknown signature or missing fuse values."));
+            return true;
+        }
+        eeprom_update_block(&tProfile, &sFuseProfilesEEPROM[tIndex], sizeof(tProfile));
+        Serial.print(F("Stored "));
+        printFuseProfile(tIndex);
+    }
+    return true;
+}
+
+/*
+ * Prints e.g. "Fuse profile 0: PLL16 930B L:F1 H:DF E:FF"
+ */
+void printFuseProfile(uint8_t aIndex) {
+    if (aIndex == NO_FUSE_PROFILE) {
+        Serial.println(F("default fuses"));
+        return;
+    }
+    FuseProfile tProfile;
+    eeprom_read_block(&tProfile, &sFuseProfilesEEPROM[aIndex], sizeof(tProfile));
+    tProfile.Name[FUSE_PROFILE_NAME_SIZE - 1] = '\0'; // For erased EEPROM
+    Serial.print(F("Fuse profile "));
+    Serial.print(aIndex);
+    Serial.print(F(": "));
+    Serial.print(tProfile.Name);
+    Serial.print(' ');
+    Serial.print(tProfile.Signature, HEX);
+    for (uint8_t i = 0; i < MAX_NUMBER_OF_FUSES; ++i) {
+        Serial.print(' ');
+        Serial.print((char) pgm_read_byte(&FuseNames[i]));
+        Serial.print(':');
+        printHexByte(tProfile.Fuses[i]);
+    }
+    Serial.println();
+}
+
+/*
+ * Select and store selection in EEPROM
+ * @param aIndex NO_FUSE_PROFILE selects the defaults
+ */
+void selectFuseProfile(uint8_t aIndex) {
+    if (aIndex != NO_FUSE_PROFILE && eeprom_read_word(&sFuseProfilesEEPROM[aIndex].Signature) == FUSE_PROFILE_EMPTY) {
+        Serial.println(F("Profile is empty."));
+        return;
+    }
+    sSelectedFuseProfile = aIndex;
+    eeprom_update_byte(&sSelectedFuseProfileEEPROM, aIndex);
+    Serial.print(F("Selected "));
+    printFuseProfile(aIndex);
+}
+
+/*
+ * Select the next stored profile, after the last one the defaults are selected
+ */
+void selectNextFuseProfile() {
+    uint8_t tIndex = sSelectedFuseProfile;
+    do {
+        tIndex = (tIndex == NO_FUSE_PROFILE) ? 0 : tIndex + 1;
+        if (tIndex >= MAX_FUSE_PROFILES) {
+            tIndex = NO_FUSE_PROFILE;
+            break;
+        }
+    } while (eeprom_read_word(&sFuseProfilesEEPROM[tIndex].Signature) == FUSE_PROFILE_EMPTY);
+    selectFuseProfile(tIndex);
+}
+
+/*
+ * Apply VCC and 12 V to the target with SDI, SII and SDO low, which enables HVSP mode
+ */
+void enterHVProgrammingMode() {
+    const PowerUpTiming *tTimingPGM = &PowerUpTimings[sPowerUpTimingIndex];
+    uint8_t tVCCTo12VMicros = pgm_read_byte(&tTimingPGM->VCCTo12VMicros);
+    uint8_t tHoldProgEnableMicros = pgm_read_byte(&tTimingPGM->HoldProgEnableMicros);
+    uint16_t tSettleMicros = pgm_read_word(&tTimingPGM->SettleMicros);
+
+#if defined(HVPP_ENGINE)
+    // Prog_enable pins PAGEL, XA1, XA0 and BS1 low
+    fastDigitalWriteLow(PAGEL);
+    fastDigitalWriteLow(XA1);
+    fastDigitalWriteLow(XA0);
+    fastDigitalWriteLow(BS1);
+#else
+    // Prog_enable pins SDI, SII and SDO low
+    fastDigitalWriteLow(SDI);
+    fastDigitalWriteLow(SII);
+    fastDigitalWriteLow(SDO);
+    fastPinModeOutput(SDO);
+#endif
+#if defined(HVSP_GANG)
+    GANG_SDO_PORT &= ~GANG_SOCKET_MASK;
+    GANG_SDO_DDR |= GANG_SOCKET_MASK;
+#endif
+    fastDigitalWriteHigh(RST); // 12v Off
+    /*
+     * No interrupt may stretch the time between VCC and 12 V.
+     * The longest profile keeps interrupts disabled for 110 us, which the 2 byte receive buffer of the USART bridges at 115200 baud.
+     */
+    noInterrupts();
+    fastDigitalWriteHigh(VCC); // Vcc On
+    delayMicroseconds(tVCCTo12VMicros);
+    fastDigitalWriteLow(RST); // 12v On
+    delayMicroseconds(tHoldProgEnableMicros);
+#if defined(HVPP_ENGINE)
+    fastDigitalWriteHigh(OE);
+    fastDigitalWriteHigh(WR);
+#else
+    fastPinModeInput(SDO); // Release SDO to avoid drive contention
+#endif
+#if defined(HVSP_GANG)
+    GANG_SDO_DDR &= ~GANG_SOCKET_MASK;
+#endif
+    interrupts();
+    delayMicroseconds(tSettleMicros);
+    resetHVSPStatus();
+#if defined(HVSP_GANG)
+    sGangActiveMask = GANG_SOCKET_MASK;
+#endif
+#if defined(HV_WATCHDOG)
+    armWatchdog();
+#endif
+    sIsInProgrammingMode = true;
+}
+
+void exitHVProgrammingMode() {
+    fastDigitalWriteLow(SCI);
+    fastDigitalWriteLow(VCC); // Vcc Off
+    fastDigitalWriteHigh(RST); // 12v Off
+#if defined(HVPP_ENGINE)
+    // No line may supply the unpowered target
+    fastDigitalWriteLow(OE);
+    fastDigitalWriteLow(WR);
+    fastDigitalWriteLow(BS1);
+    fastDigitalWriteLow(PAGEL);
+    fastDigitalWriteLow(XA0);
+    fastDigitalWriteLow(XA1);
+    fastDigitalWriteLow(BS2);
+    PORTB &= ~HVPP_DATA_LOW_MASK;
+    PORTC &= ~HVPP_DATA_HIGH_MASK;
+    DDRB |= HVPP_DATA_LOW_MASK;
+    DDRC |= HVPP_DATA_HIGH_MASK;
+#endif
+#if defined(HV_WATCHDOG)
+    wdt_disable();
+#endif
+    sIsInProgrammingMode = false;
+}
+
+#if defined(HV_WATCHDOG)
+/*
+ * Watchdog in interrupt and reset mode. The first timeout calls the interrupt, the next one resets.
+ * wdt_enable() of avr-libc only supports the reset mode.
+ */
+void armWatchdog() {
+    uint8_t tSREG = SREG;
+    cli();
+    wdt_reset();
+    WDTCSR = _BV(WDCE) | _BV(WDE);
+    WDTCSR = _BV(WDIE) | _BV(WDE) | WATCHDOG_PRESCALER;
+    SREG = tSREG;
+}
+
+/*
+ * The sketch hangs in programming mode. Power down the target first, since 12 V at a part,
+ * whose VCC may drop or which is removed from the socket, is the real danger.
+ * Then store the state for setup() and wait for the reset, since the stack and the state machine can not be trusted anymore.
+ */
+ISR(WDT_vect) {
+    fastDigitalWriteLow(VCC); // Vcc Off
+    fastDigitalWriteHigh(RST); // 12v Off
+#if defined(HVPP_ENGINE)
+    // No line may supply the unpowered target until the reset makes all pins inputs
+    PORTB &= ~HVPP_DATA_LOW_MASK;
+    PORTC &= ~(HVPP_DATA_HIGH_MASK | PIN_TO_BIT_MASK(XA1) | PIN_TO_BIT_MASK(BS2));
+    PORTD &= ~(PIN_TO_BIT_MASK(OE) | PIN_TO_BIT_MASK(WR) | PIN_TO_BIT_MASK(BS1) | PIN_TO_BIT_MASK(PAGEL) | PIN_TO_BIT_MASK(XA0));
+#endif
+    sWatchdogRecord.State = sSequence.State;
+    sWatchdogRecord.Command = sSequence.Command;
+    sWatchdogRecord.IsBatchMode = sSequence.IsBatchMode;
+    sWatchdogRecord.NumberOfPassed = sSequence.NumberOfPassed;
+    sWatchdogRecord.NumberOfFailed = sSequence.NumberOfFailed;
+    sWatchdogRecord.DevicePGM = sSequence.DevicePGM;
+    sWatchdogRecord.CycleMillis = millis() - sSequence.StartMillis;
+    sWatchdogRecord.Magic = WATCHDOG_MAGIC;
+    // Reset after 16 ms instead of the next full period
+    WDTCSR = _BV(WDCE) | _BV(WDE);
+    WDTCSR = _BV(WDE);
+    while (true) {
+        ;
+    }
+}
+
+/*
+ * Called by setup() after a reset by the watchdog interrupt.
+ * An aborted cycle is counted as failed. A running batch continues with waiting for removal of the chip.
+ */
+void recoverFromWatchdogTimeout() {
+    sWatchdogRecord.Magic = 0; // Report only once
+    logEvent(LOG_WATCHDOG_TIMEOUT, sWatchdogRecord.State);
+    sStatistics.NumberOfTimeouts[STATISTICS_TIMEOUT_WATCHDOG]++;
+    uint8_t tState = sWatchdogRecord.State;
+    bool tCycleAborted = (tState != STATE_IDLE && tState != STATE_COLLECT_COMMAND && tState != STATE_BATCH_WAIT_FOR_INSERTION
+            && tState != STATE_BATCH_WAIT_FOR_REMOVAL);
+    if (tCycleAborted) {
+        countCycle(sWatchdogRecord.DevicePGM, false, sWatchdogRecord.CycleMillis);
+    }
+#if !defined(HVSP_MINIMAL)
+    if (sWatchdogRecord.IsBatchMode) {
+        sSequence.IsBatchMode = true;
+        sSequence.NumberOfPassed = sWatchdogRecord.NumberOfPassed;
+        sSequence.NumberOfFailed = sWatchdogRecord.NumberOfFailed;
+        sSequence.DeadlineMillis = millis();
+        sSequence.State = STATE_BATCH_WAIT_FOR_REMOVAL;
+        if (tCycleAborted) {
+            sSequence.NumberOfFailed++;
+            Serial.println(F("FAIL"));
+        } else if (tState == STATE_BATCH_WAIT_FOR_INSERTION) {
+            sSequence.State = STATE_BATCH_WAIT_FOR_INSERTION; // Continue waiting without counting a part
+        }
+    }
+#endif
+}
+#endif
+
+void resetHVSPStatus() {
+    sHVSPStatus = HVSP_OK;
+    sReadyTimeoutMicros = HVSP_READY_TIMEOUT_READ_MICROS;
+}
+
+/*
+ * To be called after the last frame of a write or erase command.
+ * The next waitForTargetReady() then allows the target the time required for this command.
+ */
+void expectTargetBusy(uint16_t aTimeoutMicros) {
+    sReadyTimeoutMicros = aTimeoutMicros;
+}
+
+/*
+ * Wait until SDO goes high, but not longer than the timeout selected by expectTargetBusy().
+ * Uses unsigned micros() differences, which are not affected by the micros() overflow.
+ * @return false and set sHVSPStatus to HVSP_ERROR_TIMEOUT if timeout occurred
+ */
+bool waitForTargetReady() {
+    if (sHVSPStatus != HVSP_OK) {
+        return false;
+    }
+    uint16_t tTimeoutMicros = sReadyTimeoutMicros;
+    sReadyTimeoutMicros = HVSP_READY_TIMEOUT_READ_MICROS;
+    if (isTargetReady()) {
+        return true; // fast path, target is already ready
+    }
+    uint32_t tStartMicros = micros();
+    while (!isTargetReady()) {
+        if (sTargetBusyCallback != NULL) {
+            sTargetBusyCallback();
+        }
+        if (micros() - tStartMicros > tTimeoutMicros) {
+            bool tContinue = handleReadyTimeout(tTimeoutMicros);
+#if defined(HVSP_INSTRUMENTATION)
+            storeTraceEntry(TRACE_EVENT_READY_WAIT, sHVSPStatus, tStartMicros);
+#endif
+            return tContinue;
+        }
+    }
+#if defined(HVSP_INSTRUMENTATION)
+    storeTraceEntry(TRACE_EVENT_READY_WAIT, HVSP_OK, tStartMicros);
+#endif
+    return true;
+}
+
+/*
+ * In gang mode only the sockets which are not ready are removed, and the others continue.
+ * @return true if there are targets left to continue with
+ */
+bool handleReadyTimeout(uint16_t aTimeoutMicros) {
+#if defined(HVSP_GANG)
+    sGangActiveMask &= GANG_SDO_PIN;
+    if (sGangActiveMask != 0) {
+        return true;
+    }
+#endif
+    countTimeout(aTimeoutMicros);
+    sHVSPStatus = HVSP_ERROR_TIMEOUT;
+    return false;
+}
+
+/*
+ * The operation is known by the timeout it selected by expectTargetBusy()
+ */
+void countTimeout(uint16_t aTimeoutMicros) {
+    uint8_t tIndex = STATISTICS_TIMEOUT_ERASE;
+    if (aTimeoutMicros <= HVSP_READY_TIMEOUT_READ_MICROS) {
+        tIndex = STATISTICS_TIMEOUT_READ;
+    } else if (aTimeoutMicros <= HVSP_READY_TIMEOUT_WRITE_MICROS) {
+        tIndex = STATISTICS_TIMEOUT_WRITE;
+    }
+    sStatistics.NumberOfTimeouts[tIndex]++;
+}
+
+/*
+ * Parts without a known signature are only counted in the totals
+ */
+void countCycle(const DeviceInfo *aDevicePGM, bool aSuccess, uint32_t aCycleMillis) {
+    if (aCycleMillis > 0xFFFF) {
+        aCycleMillis = 0xFFFF;
+    }
+    sStatistics.NumberOfCycles++;
+    sStatistics.SumOfCycleMillis += aCycleMillis;
+    if (aCycleMillis > sStatistics.MaxCycleMillis) {
+        sStatistics.MaxCycleMillis = aCycleMillis;
+    }
+    SignatureStatistics *tEntry = NULL;
+    if (aDevicePGM != NULL) {
+        uint16_t tSignature = pgm_read_word(&aDevicePGM->Signature);
+        for (uint8_t i = 0; i < STATISTICS_SIGNATURES; ++i) {
+            if (sStatistics.Signatures[i].Signature == tSignature || sStatistics.Signatures[i].Signature == 0) {
+                tEntry = &sStatistics.Signatures[i];
+                tEntry->Signature = tSignature;
+                break;
+            }
+        }
+    }
+    if (aSuccess) {
+        sStatistics.NumberOfPassed++;
+        if (tEntry != NULL) {
+            tEntry->NumberOfPassed++;
+        }
+    } else {
+        sStatistics.NumberOfFailed++;
+        if (tEntry != NULL) {
+            tEntry->NumberOfFailed++;
+        }
+    }
+}
+
+#if defined(HVSP_INSTRUMENTATION)
+void storeTraceEntry(uint8_t aEvent, uint8_t aValue, uint32_t aStartMicros) {
+    uint32_t tDuration = micros() - aStartMicros;
+    TraceEntry *tEntry = &sTraceBuffer[sTraceWriteIndex];
+    tEntry->StartMicros = aStartMicros;
+    tEntry->DurationMicros = (tDuration > 0xFFFF) ? 0xFFFF : tDuration;
+    tEntry->Event = aEvent;
+    tEntry->Value = aValue;
+    sTraceWriteIndex = (sTraceWriteIndex + 1) & (TRACE_BUFFER_SIZE - 1);
+    if (sTraceLength < TRACE_BUFFER_SIZE) {
+        sTraceLength++;
+    }
+}
+#endif
+
+#if defined(HVPP_ENGINE)
+/*
+ * Execute one HVSP frame on the parallel interface. The data byte is the value of SDI and the instruction byte the one of SII.
+ * If XA1 and XA0 select a load, i.e. are not both 1, the data byte is put on the bus and latched by a positive XTAL1 pulse.
+ * If OE is active, the bus is sampled. Like SDO of HVSP, this value is returned by this and the following frames.
+ * The lines keep their levels until the next frame, so WR and PAGEL pulses are made by two consecutive frames.
+ * Like OE, WR is released first and activated last, so BS1, BS2 and XA1/XA0 are stable while WR is low.
+ * Does nothing and returns 0 if the target did not get ready or a previous frame had a timeout.
+ */
+byte parallelOut(byte aData, byte aInstruction) {
+    static uint8_t sLastReadData;
+    if (!waitForTargetReady()) {
+        return 0;
+    }
+    TRACE_START();
+    if (aInstruction & INSTRUCTION_OE) {
+        fastDigitalWriteHigh(OE); // Target releases the bus before it may be driven by a load
+    }
+    if (aInstruction & INSTRUCTION_WR) {
+        fastDigitalWriteHigh(WR); // End a write pulse before BS1, BS2 and XA change
+    }
+    if (aInstruction & (INSTRUCTION_BS1 | INSTRUCTION_PAGEL)) {
+        fastDigitalWriteHigh(BS1);
+    } else {
+        fastDigitalWriteLow(BS1);
+    }
+    if (aInstruction & INSTRUCTION_PAGEL) {
+        fastDigitalWriteHigh(PAGEL);
+    } else {
+        fastDigitalWriteLow(PAGEL);
+    }
+    if (aInstruction & INSTRUCTION_BS2) {
+        fastDigitalWriteHigh(BS2);
+    } else {
+        fastDigitalWriteLow(BS2);
+    }
+    if ((aInstruction & (INSTRUCTION_XA1 | INSTRUCTION_XA0)) != (INSTRUCTION_XA1 | INSTRUCTION_XA0)) {
+        if (aInstruction & INSTRUCTION_XA1) {
+            fastDigitalWriteHigh(XA1);
+        } else {
+            fastDigitalWriteLow(XA1);
+        }
+        if (aInstruction & INSTRUCTION_XA0) {
+            fastDigitalWriteHigh(XA0);
+        } else {
+            fastDigitalWriteLow(XA0);
+        }
+        PORTB = (PORTB & ~HVPP_DATA_LOW_MASK) | (aData & HVPP_DATA_LOW_MASK);
+        PORTC = (PORTC & ~HVPP_DATA_HIGH_MASK) | (aData >> 6);
+        DDRB |= HVPP_DATA_LOW_MASK;
+        DDRC |= HVPP_DATA_HIGH_MASK;
+        fastDigitalWriteHigh(XTAL1);
+        __builtin_avr_delay_cycles(HVPP_XTAL1_PULSE_CYCLES);
+        fastDigitalWriteLow(XTAL1);
+    } else {
+        // No load, XA1 is BS2 for parts with combined XA1/BS2 pin
+        fastDigitalWriteHigh(XA0);
+        if (aInstruction & INSTRUCTION_BS2) {
+            fastDigitalWriteHigh(XA1);
+        } else {
+            fastDigitalWriteLow(XA1);
+        }
+    }
+    if (!(aInstruction & INSTRUCTION_WR)) {
+        fastDigitalWriteLow(WR); // Start a write pulse only after all selects are valid
+    }
+    if (!(aInstruction & INSTRUCTION_OE)) {
+        // Release the bus without pull-ups, then enable the output of the target
+        DDRB &= ~HVPP_DATA_LOW_MASK;
+        DDRC &= ~HVPP_DATA_HIGH_MASK;
+        PORTB &= ~HVPP_DATA_LOW_MASK;
+        PORTC &= ~HVPP_DATA_HIGH_MASK;
+        fastDigitalWriteLow(OE);
+        __builtin_avr_delay_cycles(HVPP_OE_TO_DATA_CYCLES);
+        sLastReadData = (PINB & HVPP_DATA_LOW_MASK) | ((PINC & HVPP_DATA_HIGH_MASK) << 6);
+    }
+    TRACE_END(TRACE_EVENT_FRAME, aInstruction);
+    return sLastReadData;
+}
+#else
+/*
+ * Shift one 11 bit frame to SDI and SII and read the SDO bits.
+ * Does nothing and returns 0 if the target did not get ready or a previous frame had a timeout.
+ */
+byte shiftOut(byte val1, byte val2) {
+    if (!waitForTargetReady()) {
+        return 0;
+    }
+    TRACE_START();
+#if defined(HVSP_GANG)
+    uint8_t tSDOSamples[11];
+    uint8_t tSampleIndex = 0;
+#else
+    uint16_t inBits = 0;
+#endif
+    uint16_t dout = (uint16_t) val1 << 2;
+    uint16_t iout = (uint16_t) val2 << 2;
+#if defined(HVSP_TIMER_SCI_ENGINE)
+    /*
+     * Timer 1 fast PWM with TOP at ICR1. OC1A (SCI) is set at BOTTOM and cleared at compare match.
+     * Start shortly before TOP, so the first rising edge comes after the first data is set.
+     * The clock runs freely, so an interrupt in the low phase would let the timer clock a stale bit.
+     * The 11 bits take 33 us with interrupts disabled, which is less than one character at 115200 baud.
+     */
+    noInterrupts();
+    TCCR1B = 0;
+    TCCR1A = _BV(COM1A1) | _BV(WGM11);
+    ICR1 = HVSP_TIMER_SCI_PERIOD_CYCLES - 1;
+    OCR1A = HVSP_TIMER_SCI_HIGH_CYCLES - 1;
+    TCNT1 = HVSP_TIMER_SCI_PERIOD_CYCLES - HVSP_TIMER_SCI_START_CYCLES;
+    TIFR1 = _BV(OCF1A);
+    for (uint16_t tMask = 1 << 10; tMask != 0; tMask >>= 1) {
+        if (dout & tMask) {
+            fastDigitalWriteHigh(SDI);
+        } else {
+            fastDigitalWriteLow(SDI);
+        }
+        if (iout & tMask) {
+            fastDigitalWriteHigh(SII);
+        } else {
+            fastDigitalWriteLow(SII);
+        }
+#if defined(HVSP_GANG)
+        tSDOSamples[tSampleIndex++] = GANG_SDO_PIN;
+#else
+        inBits <<= 1;
+        if (fastDigitalRead(SDO)) {
+            inBits |= 1;
+        }
+#endif
+        if (tMask == 1 << 10) {
+            TCCR1B = _BV(WGM13) | _BV(WGM12) | _BV(CS10); // Start timer without prescaler
+        }
+        // Wait for falling edge of SCI
+        while (!(TIFR1 & _BV(OCF1A))) {
+            ;
+        }
+        TIFR1 = _BV(OCF1A);
+    }
+    TCCR1B = 0;
+    TCCR1A = 0; // Disconnect OC1A, SCI is low by its PORT bit
+    interrupts();
+#else
+    /*
+     * 11 bits, MSB first. Data is set and SDO is sampled while SCI is low, target latches at rising edge of SCI.
+     */
+    for (uint16_t tMask = 1 << 10; tMask != 0; tMask >>= 1) {
+        if (dout & tMask) {
+            fastDigitalWriteHigh(SDI);
+        } else {
+            fastDigitalWriteLow(SDI);
+        }
+        if (iout & tMask) {
+            fastDigitalWriteHigh(SII);
+        } else {
+            fastDigitalWriteLow(SII);
+        }
+#if defined(HVSP_GANG)
+        tSDOSamples[tSampleIndex++] = GANG_SDO_PIN;
+#else
+        inBits <<= 1;
+        if (fastDigitalRead(SDO)) {
+            inBits |= 1;
+        }
+#endif
+        fastDigitalWriteHigh(SCI);
+        __builtin_avr_delay_cycles(HVSP_SCI_HALF_PERIOD_CYCLES);
+        if (sSCIDelayLoops != 0) {
+            _delay_loop_1(sSCIDelayLoops);
+        }
+        fastDigitalWriteLow(SCI);
+        __builtin_avr_delay_cycles(HVSP_SCI_HALF_PERIOD_CYCLES);
+        if (sSCIDelayLoops != 0) {
+            _delay_loop_1(sSCIDelayLoops);
+        }
+    }
+#endif
+    TRACE_END(TRACE_EVENT_FRAME, val2);
+#if defined(HVSP_GANG)
+    /*
+     * Sample 0 is before the first rising edge and the last 2 ones are the trailing 0 bits of the frame
+     */
+    uint8_t tResult = 0;
+    bool tIsFirstActive = true;
+    for (uint8_t tSocket = 0; tSocket < HVSP_GANG_SOCKETS; ++tSocket) {
+        uint8_t tValue = 0;
+        for (uint8_t i = 1; i < 9; ++i) {
+            tValue <<= 1;
+            if (tSDOSamples[i] & _BV(tSocket)) {
+                tValue |= 1;
+            }
+        }
+        sGangFrameResults[tSocket] = tValue;
+        if (tIsFirstActive && (sGangActiveMask & _BV(tSocket))) {
+            tIsFirstActive = false;
+            tResult = tValue;
+        }
+    }
+    return tResult;
+#else
+    return inBits >> 2;
+#endif
+}
+#endif
+
+/*
+ * Shift all frames of a sequence without any delay in between.
+ * @param aArguments    Values for frames with FRAME_SDI_FROM_ARGUMENT or FRAME_SII_FROM_ARGUMENT, may be NULL if sequence has none
+ * @param aResultBuffer Receives the SDO values of frames with FRAME_STORE_SDO, may be NULL if sequence has none
+ * @return sHVSPStatus
+ */
+uint8_t executeHVSPSequence(const HVSPFrame *aSequencePGM, uint8_t aNumberOfFrames, const uint8_t *aArguments, uint8_t *aResultBuffer) {
+#if defined(HV_WATCHDOG)
+    wdt_reset();
+#endif
+#if defined(HVSP_GANG)
+    uint8_t tResultIndex = 0;
+#endif
+    for (uint8_t i = 0; i < aNumberOfFrames; ++i) {
+        uint8_t tFlags = pgm_read_byte(&aSequencePGM[i].Flags);
+        uint8_t tSDIValue = pgm_read_byte(&aSequencePGM[i].SDIValue);
+        uint8_t tSIIValue = pgm_read_byte(&aSequencePGM[i].SIIValue);
+        if (tFlags & FRAME_SDI_FROM_ARGUMENT) {
+            tSDIValue = *aArguments++;
+        }
+        if (tFlags & FRAME_SII_FROM_ARGUMENT) {
+            tSIIValue = *aArguments++;
+        }
+        uint8_t tSDOValue = SHIFT_OUT(tSDIValue, tSIIValue);
+        if (tFlags & FRAME_STORE_SDO) {
+            *aResultBuffer++ = tSDOValue;
+#if defined(HVSP_GANG)
+            if (tResultIndex < GANG_MAX_RESULTS) {
+                for (uint8_t tSocket = 0; tSocket < HVSP_GANG_SOCKETS; ++tSocket) {
+                    sGangResults[tSocket][tResultIndex] = sGangFrameResults[tSocket];
+                }
+            }
+            tResultIndex++;
+#endif
+        }
+        if (tFlags & FRAME_BUSY_WRITE) {
+            expectTargetBusy(HVSP_READY_TIMEOUT_WRITE_MICROS);
+        } else if (tFlags & FRAME_BUSY_ERASE) {
+            expectTargetBusy(HVSP_READY_TIMEOUT_ERASE_MICROS);
+        }
+    }
+    return sHVSPStatus;
+}
+
+/*
+ * Write fuse and wait for the target to finish writing
+ * @param aFuseAddress LFUSE, HFUSE or EFUSE
+ */
+bool writeFuseValue(uint16_t aFuseAddress, uint8_t aValue) {
+    TRACE_START();
+    uint8_t tArguments[] = { aValue, (uint8_t) (aFuseAddress >> 8), (uint8_t) aFuseAddress };
+    runHVSPSequence(WriteFuseSequence, tArguments, NULL);
+    bool tResult = waitForTargetReady();
+    TRACE_END(TRACE_EVENT_WRITE_FUSE, aValue);
+    return tResult;
+}
+
+/*
+ * Read and log all fuses
+ * @param aFuses receives low, high and extended fuse
+ */
+bool readFuses(uint8_t *aFuses) {
+    logEvent(LOG_READING_FUSES);
+    TRACE_START();
+    runHVSPSequence(ReadFusesSequence, NULL, aFuses);
+    TRACE_END(TRACE_EVENT_READ_FUSES, 0);
+    if (sHVSPStatus != HVSP_OK) {
+        logEvent(LOG_FUSES_TIMEOUT);
+        return false;
+    }
+    logEvent(LOG_FUSES, aFuses[LFUSE_INDEX], aFuses[HFUSE_INDEX], aFuses[EFUSE_INDEX]);
+    return true;
+}
+
+#if !defined(HVSP_MINIMAL)
+/*
+ * Queue a log record. If the buffer is full, the record is dropped and counted.
+ */
+void logEvent(uint8_t aEvent, uint8_t aData0, uint8_t aData1, uint8_t aData2) {
+    uint8_t tNextWriteIndex = (sLogWriteIndex + 1) & (LOG_BUFFER_SIZE - 1);
+    if (tNextWriteIndex == sLogReadIndex) {
+        if (sNumberOfDroppedLogRecords < 0xFF) {
+            sNumberOfDroppedLogRecords++;
+        }
+        return;
+    }
+    LogRecord *tRecord = &sLogBuffer[sLogWriteIndex];
+    tRecord->Event = aEvent;
+    tRecord->Data[0] = aData0;
+    tRecord->Data[1] = aData1;
+    tRecord->Data[2] = aData2;
+    sLogWriteIndex = tNextWriteIndex;
+}
+
+/*
+ * Format and print all queued log records. Must only be called if no HVSP timing is affected.
+ */
+void flushLog() {
+    while (sLogReadIndex != sLogWriteIndex) {
+        LogRecord *tRecord = &sLogBuffer[sLogReadIndex];
+        const char *tText = (const char*) pgm_read_ptr(&LogMessages[tRecord->Event]);
+        uint8_t tDataIndex = 0;
+        char tCharacter;
+        while ((tCharacter = pgm_read_byte(tText++)) != '\0') {
+            uint8_t tData = tRecord->Data[tDataIndex];
+            if (tCharacter == '%') {
+                printHexByte(tData);
+            } else if (tCharacter == '#') {
+                Serial.print(tData);
+            } else if (tCharacter == '$') {
+                Serial.print((char) tData);
+            } else if (tCharacter == '@') {
+                Serial.print((const __FlashStringHelper*) DeviceTable[tData].Name);
+            } else {
+                Serial.print(tCharacter);
+                continue;
+            }
+            if (tDataIndex < LOG_MAX_DATA_BYTES - 1) {
+                tDataIndex++;
+            }
+        }
+        Serial.println();
+        sLogReadIndex = (sLogReadIndex + 1) & (LOG_BUFFER_SIZE - 1);
+    }
+    if (sNumberOfDroppedLogRecords > 0) {
+        Serial.print(sNumberOfDroppedLogRecords);
+        Serial.println(F(" log records dropped."));
+        sNumberOfDroppedLogRecords = 0;
+    }
+}
+#endif
+
+/*
+ * Run the identify transaction and print its result.
+ * Prints e.g. "Signature: 1E930B Calibration: 5A FF Fuses L:62 H:DF E:FF Lock bits: FF"
+ */
+void printIdentifyResult() {
+    IdentifyResult tResult;
+    if (runHVSPSequence(IdentifySequence, NULL, (uint8_t*) &tResult) != HVSP_OK) {
+        Serial.println(F("Timeout while identifying."));
+        return;
+    }
+    Serial.print(F("Signature: "));
+    for (uint8_t i = 0; i < sizeof(tResult.Signature); ++i) {
+        printHexByte(tResult.Signature[i]);
+    }
+    Serial.print(F(" Calibration: "));
+    printHexByte(tResult.Calibration[0]);
+    Serial.print(' ');
+    printHexByte(tResult.Calibration[1]);
+    Serial.print(F(" Fuses"));
+    for (uint8_t i = 0; i < MAX_NUMBER_OF_FUSES; ++i) {
+        Serial.print(' ');
+        Serial.print((char) pgm_read_byte(&FuseNames[i]));
+        Serial.print(':');
+        printHexByte(tResult.Fuses[i]);
+    }
+    Serial.print(F(" Lock bits: "));
+    printHexByte(tResult.LockBits);
+    Serial.println();
+}
+
+uint8_t readFuse(uint8_t aFuseIndex) {
+    uint16_t tAddress = pgm_read_word(&FuseReadAddresses[aFuseIndex]);
+    uint8_t tArguments[] = { (uint8_t) (tAddress >> 8), (uint8_t) tAddress };
+    uint8_t tValue;
+    TRACE_START();
+    runHVSPSequence(ReadFuseSequence, tArguments, &tValue);
+    TRACE_END(TRACE_EVENT_READ_FUSE, aFuseIndex);
+    return tValue;
+}
+
+unsigned int readSignature() {
+    static const uint8_t sSignatureAddresses[] = { 1, 2 };
+    uint8_t tSignature[2];
+    TRACE_START();
+    runHVSPSequence(ReadSignatureSequence, sSignatureAddresses, tSignature);
+    TRACE_END(TRACE_EVENT_READ_SIGNATURE, 0);
+    return ((unsigned int) tSignature[0] << 8) | tSignature[1];
+}
+
+/*
+ * Single scan of the device table
+ * @return pointer to flash entry or NULL for unknown signature
+ */
+const DeviceInfo* findDevice(unsigned int aSignature) {
+    for (uint8_t i = 0; i < sizeof(DeviceTable) / sizeof(DeviceInfo); ++i) {
+        if (pgm_read_word(&DeviceTable[i].Signature) == aSignature) {
+            return &DeviceTable[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Prints e.g. "Fuse status L:W H:= E:=" See FUSE_STATUS_* for the meaning of the characters.
+ */
+void printFuseStatus(uint8_t aNumberOfFuses, const char *aFuseStatus) {
+    Serial.print(F("Fuse status"));
+    for (uint8_t i = 0; i < aNumberOfFuses; ++i) {
+        Serial.print(' ');
+        Serial.print((char) pgm_read_byte(&FuseNames[i]));
+        Serial.print(':');
+        Serial.print(aFuseStatus[i]);
+    }
+    Serial.println();
+}
+
+/*
+ * Power target up, read signature and power down again.
+ * @return device table entry of the attached HVSP part or NULL
+ */
+const DeviceInfo* pollForDevice() {
+    uint16_t tNumberOfReadTimeouts = sStatistics.NumberOfTimeouts[STATISTICS_TIMEOUT_READ];
+    enterHVProgrammingMode();
+    unsigned int tSignature = readSignature();
+    exitHVProgrammingMode();
+    sStatistics.NumberOfTimeouts[STATISTICS_TIMEOUT_READ] = tNumberOfReadTimeouts; // An empty socket is no fault of the fixture
+    if (sHVSPStatus != HVSP_OK) {
+        return NULL;
+    }
+    const DeviceInfo *tDevicePGM = findDevice(tSignature);
+    if (tDevicePGM != NULL && !isDeviceSupported(tDevicePGM)) {
+        return NULL;
+    }
+    return tDevicePGM;
+}
+
+#if defined(HVSP_GANG)
+/*
+ * Called after readSignature(). Removes all sockets with a signature different from the one of the first active socket.
+ */
+void storeGangSignatures(uint16_t aSignature) {
+    for (uint8_t tSocket = 0; tSocket < HVSP_GANG_SOCKETS; ++tSocket) {
+        struct GangSocket *tGangSocket = &sGangSockets[tSocket];
+        tGangSocket->Signature = ((uint16_t) sGangResults[tSocket][0] << 8) | sGangResults[tSocket][1];
+        memset(tGangSocket->FuseStatus, FUSE_STATUS_TIMEOUT, MAX_NUMBER_OF_FUSES);
+        if (tGangSocket->Signature != aSignature) {
+            sGangActiveMask &= ~_BV(tSocket);
+        }
+    }
+}
+
+/*
+ * Called after readFuses()
+ */
+void storeGangFuses() {
+    for (uint8_t tSocket = 0; tSocket < HVSP_GANG_SOCKETS; ++tSocket) {
+        memcpy(sGangSockets[tSocket].Fuses, sGangResults[tSocket], MAX_NUMBER_OF_FUSES);
+    }
+}
+
+/*
+ * @return true if the fuse of any active socket differs from aValue
+ */
+bool isGangFuseDifferent(uint8_t aFuseIndex, uint8_t aValue) {
+    for (uint8_t tSocket = 0; tSocket < HVSP_GANG_SOCKETS; ++tSocket) {
+        if ((sGangActiveMask & _BV(tSocket)) && sGangSockets[tSocket].Fuses[aFuseIndex] != aValue) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * @param aIsWritten true if called after the readFuse() of the verify, false if fuse was not written
+ */
+void setGangFuseStatus(uint8_t aFuseIndex, bool aIsWritten) {
+    for (uint8_t tSocket = 0; tSocket < HVSP_GANG_SOCKETS; ++tSocket) {
+        if (sGangActiveMask & _BV(tSocket)) {
+            char tStatus = FUSE_STATUS_UNCHANGED;
+            if (aIsWritten) {
+                tStatus = FUSE_STATUS_WRITTEN;
+                if (sGangResults[tSocket][0] != sSequence.TargetFuses[aFuseIndex]) {
+                    tStatus = FUSE_STATUS_VERIFY_ERROR;
+                }
+            }
+            sGangSockets[tSocket].FuseStatus[aFuseIndex] = tStatus;
+        }
+    }
+}
+
+/*
+ * Prints e.g. "Socket 1: 930B PASS Fuse status L:W H:= E:="
+ */
+void printGangReport() {
+    uint8_t tNumberOfFuses = pgm_read_byte(&sSequence.DevicePGM->NumberOfFuses);
+    for (uint8_t tSocket = 0; tSocket < HVSP_GANG_SOCKETS; ++tSocket) {
+        struct GangSocket *tGangSocket = &sGangSockets[tSocket];
+        bool tPassed = (sGangActiveMask & _BV(tSocket)) != 0;
+        for (uint8_t i = 0; i < tNumberOfFuses; ++i) {
+            if (tGangSocket->FuseStatus[i] != FUSE_STATUS_UNCHANGED && tGangSocket->FuseStatus[i] != FUSE_STATUS_WRITTEN) {
+                tPassed = false;
+            }
+        }
+        Serial.print(F("Socket "));
+        Serial.print(tSocket);
+        Serial.print(F(": "));
+        Serial.print(tGangSocket->Signature, HEX);
+        if (tPassed) {
+            Serial.print(F(" PASS "));
+        } else {
+            Serial.print(F(" FAIL "));
+        }
+        printFuseStatus(tNumberOfFuses, tGangSocket->FuseStatus);
+    }
+}
+#endif
+
+#if defined(HVSP_BENCHMARK)
+/*
+ * Reference engine with digitalWrite() and digitalRead()
+ */
+byte shiftOutDigitalWrite(byte val1, byte val2) {
+    if (!waitForTargetReady()) {
+        return 0;
+    }
+    uint16_t inBits = 0;
+    uint16_t dout = (uint16_t) val1 << 2;
+    uint16_t iout = (uint16_t) val2 << 2;
+    for (uint16_t tMask = 1 << 10; tMask != 0; tMask >>= 1) {
+        digitalWrite(SDI, (dout & tMask) ? HIGH : LOW);
+        digitalWrite(SII, (iout & tMask) ? HIGH : LOW);
+        inBits <<= 1;
+        if (digitalRead(SDO)) {
+            inBits |= 1;
+        }
+        digitalWrite(SCI, HIGH);
+        digitalWrite(SCI, LOW);
+    }
+    return inBits >> 2;
+}
+
+void printBenchmarkResult(const __FlashStringHelper *aEngineName, const __FlashStringHelper *aMetric, uint32_t aValue,
+        const __FlashStringHelper *aUnit) {
+    Serial.print(F("BENCH "));
+    Serial.print(aEngineName);
+    Serial.print(' ');
+    Serial.print(aMetric);
+    Serial.print(' ');
+    Serial.print(aValue);
+    Serial.print(' ');
+    Serial.println(aUnit);
+}
+
+/*
+ * Duration is taken in units of 16 us to avoid an overflow for 8 kByte
+ */
+uint32_t getBytesPerSecond(uint16_t aNumberOfBytes, uint32_t aDurationMicros) {
+    return ((uint32_t) aNumberOfBytes * (1000000 / 16)) / ((aDurationMicros / 16) | 1);
+}
+
+void runBenchmarkForEngine(const __FlashStringHelper *aEngineName, const DeviceInfo *aDevicePGM) {
+    uint32_t tStartMicros = micros();
+    for (uint16_t i = 0; i < BENCHMARK_FRAMES; ++i) {
+        runHVSPSequence(NoOperationSequence, NULL, NULL);
+    }
+    uint32_t tDurationMicros = micros() - tStartMicros;
+    printBenchmarkResult(aEngineName, F("frame_rate"), (BENCHMARK_FRAMES * 1000000UL) / tDurationMicros, F("frames/s"));
+
+    tStartMicros = micros();
+    for (uint8_t i = 0; i < BENCHMARK_REPETITIONS; ++i) {
+        readSignature();
+    }
+    printBenchmarkResult(aEngineName, F("signature_read"), (micros() - tStartMicros) / BENCHMARK_REPETITIONS, F("us"));
+
+    uint8_t tFuses[MAX_NUMBER_OF_FUSES];
+    tStartMicros = micros();
+    for (uint8_t i = 0; i < BENCHMARK_REPETITIONS; ++i) {
+        runHVSPSequence(ReadFusesSequence, NULL, tFuses);
+    }
+    printBenchmarkResult(aEngineName, F("fuses_read"), (micros() - tStartMicros) / BENCHMARK_REPETITIONS, F("us"));
+
+    // Write and read back the current value of the low fuse
+    tStartMicros = micros();
+    for (uint8_t i = 0; i < BENCHMARK_WRITE_REPETITIONS; ++i) {
+        writeFuseValue(LFUSE, tFuses[LFUSE_INDEX]);
+        readFuse(LFUSE_INDEX);
+    }
+    printBenchmarkResult(aEngineName, F("fuse_write_verify"), (micros() - tStartMicros) / BENCHMARK_WRITE_REPETITIONS, F("us"));
+
+    uint8_t tChunk[BENCHMARK_CHUNK_SIZE];
+    uint16_t tFlashSize = pgm_read_word(&aDevicePGM->FlashSize);
+    tStartMicros = micros();
+    for (uint16_t tAddress = 0; tAddress < tFlashSize; tAddress += BENCHMARK_CHUNK_SIZE) {
+        readFlashBytes(tAddress, BENCHMARK_CHUNK_SIZE, tChunk);
+    }
+    printBenchmarkResult(aEngineName, F("flash_read"), getBytesPerSecond(tFlashSize, micros() - tStartMicros), F("bytes/s"));
+
+    uint16_t tEEPROMSize = pgm_read_word(&aDevicePGM->EEPROMSize);
+    if (tEEPROMSize > MAX_EEPROM_SIZE) {
+        tEEPROMSize = MAX_EEPROM_SIZE; // Size of the buffer used
+    }
+    tStartMicros = micros();
+    for (uint16_t tAddress = 0; tAddress < tEEPROMSize; tAddress += BENCHMARK_CHUNK_SIZE) {
+        readEEPROMBytes(tAddress, BENCHMARK_CHUNK_SIZE, &sEEPROMSnapshot[tAddress]);
+    }
+    printBenchmarkResult(aEngineName, F("eeprom_read"), getBytesPerSecond(tEEPROMSize, micros() - tStartMicros), F("bytes/s"));
+
+    uint8_t tPageSize = pgm_read_byte(&aDevicePGM->EEPROMPageSize);
+    tStartMicros = micros();
+    for (uint16_t tAddress = 0; tAddress < tEEPROMSize; tAddress += BENCHMARK_CHUNK_SIZE) {
+        writeEEPROMBytes(tAddress, BENCHMARK_CHUNK_SIZE, &sEEPROMSnapshot[tAddress], tPageSize);
+    }
+    printBenchmarkResult(aEngineName, F("eeprom_write"), getBytesPerSecond(tEEPROMSize, micros() - tStartMicros), F("bytes/s"));
+
+    if (sHVSPStatus != HVSP_OK) {
+        Serial.print(F("BENCH "));
+        Serial.print(aEngineName);
+        Serial.println(F(" error timeout"));
+    }
+}
+
+void runBenchmark(const DeviceInfo *aDevicePGM) {
+    runBenchmarkForEngine(F(COMPILED_ENGINE_NAME), aDevicePGM);
+#if defined(HVSP_PORT_IO) && !defined(HVPP_ENGINE)
+    sShiftOutFunction = &shiftOutDigitalWrite;
+    runBenchmarkForEngine(F("digitalWrite"), aDevicePGM);
+    sShiftOutFunction = &shiftOut;
+#endif
+}
+#endif
+
+#if defined(SCI_AUTO_TUNE)
+void setSCIRate(uint8_t aIndex) {
+    sSCIRateIndex = aIndex;
+    sSCIDelayLoops = pgm_read_byte(&SCIRateDelayLoops[aIndex]);
+}
+
+/*
+ * @return true if SCI_TUNE_REPETITIONS reads of signature and fuses at the current rate all return the reference values
+ */
+bool isSCIRateStable(unsigned int aReferenceSignature, uint8_t *aReferenceFuses) {
+    uint8_t tFuses[MAX_NUMBER_OF_FUSES];
+    for (uint8_t i = 0; i < SCI_TUNE_REPETITIONS; ++i) {
+        if (readSignature() != aReferenceSignature) {
+            return false;
+        }
+        runHVSPSequence(ReadFusesSequence, NULL, tFuses);
+        if (sHVSPStatus != HVSP_OK || memcmp(tFuses, aReferenceFuses, MAX_NUMBER_OF_FUSES) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Step up the SCI rate, starting with the slowest one, until a rate is not stable.
+ * The reference values are read at the slowest rate. The fastest stable rate minus SCI_TUNE_MARGIN is used and stored.
+ * A failed rate may leave the target out of sync, so programming mode must be left afterwards.
+ */
+void autoTuneSCIRate() {
+    uint8_t tPreviousIndex = sSCIRateIndex;
+    setSCIRate(0);
+    unsigned int tReferenceSignature = readSignature();
+    uint8_t tReferenceFuses[MAX_NUMBER_OF_FUSES];
+    runHVSPSequence(ReadFusesSequence, NULL, tReferenceFuses);
+
+    uint8_t tNumberOfStableRates = 0;
+    if (sHVSPStatus == HVSP_OK) {
+        while (tNumberOfStableRates < NUMBER_OF_SCI_RATES) {
+            setSCIRate(tNumberOfStableRates);
+            bool tIsStable = isSCIRateStable(tReferenceSignature, tReferenceFuses);
+            Serial.print(F("SCI rate "));
+            Serial.print(tNumberOfStableRates);
+            Serial.print(F(", delay loops "));
+            Serial.print(sSCIDelayLoops);
+            if (!tIsStable) {
+                Serial.println(F(" failed"));
+                break;
+            }
+            Serial.println(F(" stable"));
+            tNumberOfStableRates++;
+        }
+    }
+
+    if (tNumberOfStableRates == 0) {
+        setSCIRate(tPreviousIndex);
+        Serial.println(F("Even the slowest SCI rate is not stable, keep current rate."));
+        return;
+    }
+    uint8_t tIndex = tNumberOfStableRates - 1;
+    tIndex = (tIndex > SCI_TUNE_MARGIN) ? tIndex - SCI_TUNE_MARGIN : 0;
+    setSCIRate(tIndex);
+    eeprom_update_byte(&sSCIRateIndexEEPROM, tIndex);
+    Serial.print(F("Stored SCI rate "));
+    Serial.println(tIndex);
+}
+#endif
+
+/*
+ * Stream the flash or EEPROM content to Serial record by record, as it is read from the target.
+ * Only FLASH_DUMP_RECORD_SIZE bytes are buffered.
+ * @param aBinary true: raw bytes, false: Intel HEX records
+ */
+void dumpMemory(uint16_t aSize, bool aBinary, bool aIsEEPROM) {
+    Serial.print(F("Dumping "));
+    Serial.print(aSize);
+    if (aIsEEPROM) {
+        Serial.println(F(" bytes of EEPROM"));
+    } else {
+        Serial.println(F(" bytes of flash"));
+    }
+
+    uint8_t tRecord[FLASH_DUMP_RECORD_SIZE];
+    for (uint16_t tAddress = 0; tAddress < aSize; tAddress += FLASH_DUMP_RECORD_SIZE) {
+        bool tSuccess;
+        if (aIsEEPROM) {
+            tSuccess = readEEPROMBytes(tAddress, FLASH_DUMP_RECORD_SIZE, tRecord);
+        } else {
+            tSuccess = readFlashBytes(tAddress, FLASH_DUMP_RECORD_SIZE, tRecord);
+        }
+        if (!tSuccess) {
+            Serial.println();
+            Serial.println(F("Timeout while reading."));
+            return;
+        }
+        if (aBinary) {
+            Serial.write(tRecord, FLASH_DUMP_RECORD_SIZE);
+        } else {
+            printIntelHexRecord(tAddress, 0x00, tRecord, FLASH_DUMP_RECORD_SIZE);
+        }
+    }
+    if (!aBinary) {
+        printIntelHexRecord(0, 0x01, NULL, 0); // End of file record
+    }
+}
+
+/*
+ * Read flash bytes. Address and length may be odd.
+ */
+bool readFlashBytes(uint16_t aAddress, uint8_t aLength, uint8_t *aBuffer) {
+    runHVSPSequence(LoadReadFlashCommandSequence, NULL, NULL);
+    uint8_t tWord[2];
+    while (aLength > 0) {
+        uint16_t tWordAddress = aAddress >> 1;
+        uint8_t tArguments[] = { (uint8_t) tWordAddress, (uint8_t) (tWordAddress >> 8) };
+        runHVSPSequence(ReadFlashWordSequence, tArguments, tWord);
+        uint8_t tIndex = aAddress & 1;
+        do {
+            *aBuffer++ = tWord[tIndex++];
+            aAddress++;
+            aLength--;
+        } while (tIndex < 2 && aLength > 0);
+    }
+    return sHVSPStatus == HVSP_OK;
+}
+
+/*
+ * Load page into the page buffer of the target and start the page write. Chip must be erased before.
+ * sTargetBusyCallback is called between the words.
+ * Does not wait for the end of the page write, this is done by the next frame shifted.
+ */
+bool writeFlashPage(uint16_t aPageAddress, const uint8_t *aData, uint8_t aPageSize) {
+    runHVSPSequence(LoadWriteFlashCommandSequence, NULL, NULL);
+    uint8_t tArguments[3];
+    uint16_t tWordAddress = aPageAddress >> 1;
+    for (uint8_t i = 0; i < aPageSize; i += 2) {
+        tArguments[0] = (uint8_t) tWordAddress++;
+        tArguments[1] = aData[i];
+        tArguments[2] = aData[i + 1];
+        runHVSPSequence(LoadFlashPageBufferWordSequence, tArguments, NULL);
+        if (sTargetBusyCallback != NULL) {
+            sTargetBusyCallback();
+        }
+    }
+    tArguments[0] = (aPageAddress >> 1) >> 8;
+    runHVSPSequence(WriteFlashPageSequence, tArguments, NULL);
+    sStatistics.NumberOfProgrammedBytes += aPageSize;
+    return sHVSPStatus == HVSP_OK;
+}
+
+/*
+ * CRC-32 as used by zlib and Ethernet, reflected polynomial 0xEDB88320.
+ * Start with 0xFFFFFFFF and invert the result. Bitwise, since a table would require 1 kByte.
+ */
+uint32_t updateCRC32(uint32_t aCRC, uint8_t aByte) {
+    aCRC ^= aByte;
+    for (uint8_t i = 0; i < 8; ++i) {
+        if (aCRC & 1) {
+            aCRC = (aCRC >> 1) ^ 0xEDB88320;
+        } else {
+            aCRC >>= 1;
+        }
+    }
+    return aCRC;
+}
+
+/*
+ * Read flash and accumulate the CRC without storing more than FLASH_VERIFY_CHUNK_SIZE bytes
+ */
+uint32_t computeFlashCRC32(uint16_t aAddress, uint16_t aLength) {
+    uint16_t tLength = aLength;
+    uint32_t tCRC = 0xFFFFFFFF;
+    uint8_t tChunk[FLASH_VERIFY_CHUNK_SIZE];
+    while (aLength > 0) {
+        uint8_t tChunkLength = (aLength > FLASH_VERIFY_CHUNK_SIZE) ? FLASH_VERIFY_CHUNK_SIZE : aLength;
+        if (!readFlashBytes(aAddress, tChunkLength, tChunk)) {
+            break;
+        }
+        for (uint8_t i = 0; i < tChunkLength; ++i) {
+            tCRC = updateCRC32(tCRC, tChunk[i]);
+        }
+        aAddress += tChunkLength;
+        aLength -= tChunkLength;
+    }
+    if (aLength == 0) {
+        sStatistics.NumberOfVerifiedBytes += tLength;
+    }
+    return ~tCRC;
+}
+
+bool readEEPROMBytes(uint16_t aAddress, uint8_t aLength, uint8_t *aBuffer) {
+    runHVSPSequence(LoadReadEEPROMCommandSequence, NULL, NULL);
+    for (uint8_t i = 0; i < aLength; ++i) {
+        uint8_t tArguments[] = { (uint8_t) aAddress, (uint8_t) (aAddress >> 8) };
+        runHVSPSequence(ReadEEPROMByteSequence, tArguments, &aBuffer[i]);
+        aAddress++;
+    }
+    return sHVSPStatus == HVSP_OK;
+}
+
+/*
+ * Write EEPROM and wait for the target to finish writing.
+ * @param aPageSize If > 1, each page is loaded and written at once, otherwise EEPROM is written byte by byte
+ */
+bool writeEEPROMBytes(uint16_t aAddress, uint8_t aLength, const uint8_t *aData, uint8_t aPageSize) {
+    if (aPageSize > 1) {
+        while (aLength > 0) {
+            // Up to the end of the page of aAddress
+            uint8_t tLength = aPageSize - (aAddress & (aPageSize - 1));
+            if (tLength > aLength) {
+                tLength = aLength;
+            }
+            writeEEPROMPage(aAddress, tLength, aData);
+            aAddress += tLength;
+            aData += tLength;
+            aLength -= tLength;
+        }
+    } else {
+        for (uint8_t i = 0; i < aLength; ++i) {
+            uint8_t tArguments[] = { (uint8_t) aAddress, (uint8_t) (aAddress >> 8), aData[i] };
+            runHVSPSequence(WriteEEPROMByteSequence, tArguments, NULL);
+            aAddress++;
+        }
+        sStatistics.NumberOfProgrammedBytes += aLength;
+    }
+    return waitForTargetReady();
+}
+
+/*
+ * Load bytes into the EEPROM page buffer and start the page write. Does not wait for the end of the write.
+ * All bytes must be in the same page, only the loaded bytes are written.
+ */
+bool writeEEPROMPage(uint16_t aAddress, uint8_t aLength, const uint8_t *aData) {
+    runHVSPSequence(LoadWriteEEPROMCommandSequence, NULL, NULL);
+    uint8_t tAddressHigh = aAddress >> 8;
+    runHVSPSequence(LoadEEPROMAddressHighSequence, &tAddressHigh, NULL);
+    for (uint8_t i = 0; i < aLength; ++i) {
+        uint8_t tArguments[] = { (uint8_t) aAddress, aData[i] };
+        runHVSPSequence(LoadEEPROMPageBufferByteSequence, tArguments, NULL);
+        aAddress++;
+    }
+    runHVSPSequence(WriteEEPROMPageSequence, NULL, NULL);
+    sStatistics.NumberOfProgrammedBytes += aLength;
+    return sHVSPStatus == HVSP_OK;
+}
+
+// Print always 2 digits
+void printHexByte(uint8_t aByte) {
+    if (aByte < 0x10) {
+        Serial.print('0');
+    }
+    Serial.print(aByte, HEX);
+}
+
+void printIntelHexRecord(uint16_t aAddress, uint8_t aRecordType, const uint8_t *aData, uint8_t aLength) {
+    uint8_t tChecksum = aLength + (uint8_t) (aAddress >> 8) + (uint8_t) aAddress + aRecordType;
+    Serial.print(':');
+    printHexByte(aLength);
+    printHexByte(aAddress >> 8);
+    printHexByte(aAddress);
+    printHexByte(aRecordType);
+    for (uint8_t i = 0; i < aLength; ++i) {
+        printHexByte(aData[i]);
+        tChecksum += aData[i];
+    }
+    printHexByte(-tChecksum);
+    Serial.println();
+}
+
+/*
+ * Erase flash, EEPROM (if EESAVE fuse is not programmed) and lock bits.
+ * Returns as soon as the target signals ready.
+ */
+bool eraseChip() {
+    runHVSPSequence(ChipEraseSequence, NULL, NULL);
+    return waitForTargetReady();
+}
+
+/*
+ * Erase chip and program flash with the Intel HEX records received by Serial until an end of file record is received.
+ */
+void programFlash(uint16_t aFlashSize, uint8_t aPageSize) {
+    Serial.println(F("Erasing chip..."));
+    if (!eraseChip()) {
+        Serial.println(F("Timeout while erasing chip."));
+        return;
+    }
+    sFlashSize = aFlashSize;
+    sFlashPageSize = aPageSize;
+    sFlashPages[0].PageAddress = FLASH_PAGE_UNUSED;
+    sFillPage = &sFlashPages[0];
+    sWritePage = NULL;
+    sFillPageComplete = false;
+    sHeldByteValid = false;
+    sNumberOfWrittenPages = 0;
+    sNumberOfSkippedPages = 0;
+    sHexParser.ByteIndex = HEX_WAIT_FOR_RECORD_START;
+    sHexParseResult = HEX_PARSE_CONTINUE;
+
+    Serial.println(F("Send Intel HEX file now."));
+    sLastHexCharacterMillis = millis();
+    sTargetBusyCallback = &receiveHexCharacters;
+    while (sHVSPStatus == HVSP_OK) {
+#if defined(HV_WATCHDOG)
+        wdt_reset(); // Waiting for the next HEX record is no hang
+#endif
+        receiveHexCharacters();
+        if (sWritePage != NULL) {
+            writeQueuedFlashPage();
+        } else if (sHexParseResult == HEX_PARSE_END_OF_FILE && sFillPage->PageAddress != FLASH_PAGE_UNUSED) {
+            queueFillPage(); // last, incomplete page
+        } else if (sHexParseResult != HEX_PARSE_CONTINUE) {
+            break;
+        } else if (millis() - sLastHexCharacterMillis > HEX_INPUT_TIMEOUT_MILLIS) {
+            sHexParseResult = HEX_PARSE_TIMEOUT;
+        }
+    }
+    sTargetBusyCallback = NULL;
+    waitForTargetReady(); // for last page write
+    runHVSPSequence(NoOperationSequence, NULL, NULL);
+
+    if (sHVSPStatus != HVSP_OK) {
+        Serial.println(F("Timeout while programming flash."));
+    } else if (sHexParseResult == HEX_PARSE_ERROR) {
+        Serial.println(F("Invalid Intel HEX data or address out of flash range."));
+    } else if (sHexParseResult == HEX_PARSE_TIMEOUT) {
+        Serial.println(F("Timeout while waiting for Intel HEX data."));
+    } else {
+        Serial.print(sNumberOfWrittenPages);
+        Serial.print(F(" flash pages written, "));
+        Serial.print(sNumberOfSkippedPages);
+        Serial.println(F(" blank pages skipped."));
+    }
+    // Skip rest of the file after an error
+    while (Serial.available() > 0) {
+        Serial.read();
+    }
+}
+
+/*
+ * Parse all characters available in the serial receive buffer.
+ * Stops if parsing is paused because both page images are in use, or at end of file or error.
+ */
+void receiveHexCharacters() {
+    while (!sFillPageComplete && sHexParseResult == HEX_PARSE_CONTINUE && Serial.available() > 0) {
+        sHexParseResult = parseIntelHexCharacter(Serial.read());
+        sLastHexCharacterMillis = millis();
+    }
+}
+
+/*
+ * Parse one character of an Intel HEX stream. Data bytes are passed to storeFlashByte() immediately,
+ * the record checksum is checked at the end of the record.
+ * Characters between records, like CR and LF, are ignored.
+ */
+uint8_t parseIntelHexCharacter(char aCharacter) {
+    if (aCharacter == ':') {
+        sHexParser.ByteIndex = 0;
+        sHexParser.HighNibbleReceived = false;
+        sHexParser.Checksum = 0;
+        return HEX_PARSE_CONTINUE;
+    }
+    if (sHexParser.ByteIndex == HEX_WAIT_FOR_RECORD_START) {
+        return HEX_PARSE_CONTINUE;
+    }
+
+    uint8_t tNibble;
+    if (aCharacter >= '0' && aCharacter <= '9') {
+        tNibble = aCharacter - '0';
+    } else if (aCharacter >= 'A' && aCharacter <= 'F') {
+        tNibble = aCharacter - 'A' + 10;
+    } else if (aCharacter >= 'a' && aCharacter <= 'f') {
+        tNibble = aCharacter - 'a' + 10;
+    } else {
+        return HEX_PARSE_ERROR;
+    }
+    if (!sHexParser.HighNibbleReceived) {
+        sHexParser.CurrentByte = tNibble << 4;
+        sHexParser.HighNibbleReceived = true;
+        return HEX_PARSE_CONTINUE;
+    }
+    sHexParser.HighNibbleReceived = false;
+
+    uint8_t tByte = sHexParser.CurrentByte | tNibble;
+    uint8_t tIndex = sHexParser.ByteIndex++;
+    sHexParser.Checksum += tByte;
+    if (tIndex == 0) {
+        if (tByte > HEX_MAX_RECORD_DATA_LENGTH) {
+            return HEX_PARSE_ERROR;
+        }
+        sHexParser.DataLength = tByte;
+    } else if (tIndex == 1) {
+        sHexParser.Address = (uint16_t) tByte << 8;
+    } else if (tIndex == 2) {
+        sHexParser.Address |= tByte;
+    } else if (tIndex == 3) {
+        sHexParser.RecordType = tByte;
+    } else if (tIndex < 4 + sHexParser.DataLength) {
+        if (sHexParser.RecordType == 0x00) {
+            if (!storeFlashByte(sHexParser.Address + (tIndex - 4), tByte)) {
+                return HEX_PARSE_ERROR;
+            }
+        } else if ((sHexParser.RecordType == 0x02 || sHexParser.RecordType == 0x04) && tByte != 0) {
+            return HEX_PARSE_ERROR; // Extended addresses above 64 kB are not supported
+        }
+    } else {
+        // Checksum byte, sum of all bytes of the record must be 0
+        sHexParser.ByteIndex = HEX_WAIT_FOR_RECORD_START;
+        if (sHexParser.Checksum != 0) {
+            return HEX_PARSE_ERROR;
+        }
+        if (sHexParser.RecordType == 0x01) {
+            return HEX_PARSE_END_OF_FILE;
+        }
+    }
+    return HEX_PARSE_CONTINUE;
+}
+
+/*
+ * Store byte in fill page image. The image is queued for writing if it is complete or if the byte belongs to another page.
+ * @return false if address is out of flash range
+ */
+bool storeFlashByte(uint16_t aAddress, uint8_t aData) {
+    if (aAddress >= sFlashSize) {
+        return false;
+    }
+    uint16_t tPageAddress = aAddress & ~(uint16_t) (sFlashPageSize - 1);
+    if (sFillPage->PageAddress != FLASH_PAGE_UNUSED && tPageAddress != sFillPage->PageAddress) {
+        queueFillPage();
+        if (sFillPageComplete) {
+            // No free page image, keep byte until write page is done
+            sHeldByteAddress = aAddress;
+            sHeldByte = aData;
+            sHeldByteValid = true;
+            return true;
+        }
+    }
+    if (sFillPage->PageAddress == FLASH_PAGE_UNUSED) {
+        sFillPage->PageAddress = tPageAddress;
+        sFillPage->ByteCount = 0;
+        memset(sFillPage->Data, 0xFF, sFlashPageSize);
+    }
+    sFillPage->Data[aAddress - tPageAddress] = aData;
+    if (++sFillPage->ByteCount >= sFlashPageSize) {
+        queueFillPage();
+    }
+    return true;
+}
+
+/*
+ * Hand fill page over to writing and continue filling the other page image.
+ * If the write page is still in use, set sFillPageComplete, which pauses parsing.
+ */
+void queueFillPage() {
+    if (sWritePage != NULL) {
+        sFillPageComplete = true;
+        return;
+    }
+    sWritePage = sFillPage;
+    sFillPage = (sFillPage == &sFlashPages[0]) ? &sFlashPages[1] : &sFlashPages[0];
+    sFillPage->PageAddress = FLASH_PAGE_UNUSED;
+    sFillPageComplete = false;
+}
+
+/*
+ * @return true if all bytes are 0xFF, the value of erased flash
+ */
+bool isBlank(const uint8_t *aData, uint8_t aLength) {
+    for (uint8_t i = 0; i < aLength; ++i) {
+        if (aData[i] != 0xFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Read flash until the first byte which is not 0xFF
+ * @param aFirstNonBlankAddress receives the address of this byte, or aFlashSize if flash is blank
+ * @return true if flash is blank
+ */
+bool blankCheckFlash(uint16_t aFlashSize, uint16_t *aFirstNonBlankAddress) {
+    uint8_t tChunk[FLASH_VERIFY_CHUNK_SIZE];
+    for (uint16_t tAddress = 0; tAddress < aFlashSize; tAddress += FLASH_VERIFY_CHUNK_SIZE) {
+        if (!readFlashBytes(tAddress, FLASH_VERIFY_CHUNK_SIZE, tChunk)) {
+            break;
+        }
+        for (uint8_t i = 0; i < FLASH_VERIFY_CHUNK_SIZE; ++i) {
+            if (tChunk[i] != 0xFF) {
+                *aFirstNonBlankAddress = tAddress + i;
+                return false;
+            }
+        }
+    }
+    *aFirstNonBlankAddress = aFlashSize;
+    return sHVSPStatus == HVSP_OK;
+}
+
+/*
+ * Load queued page image into the page buffer of the target and start the page write.
+ * Received characters are parsed into the fill page between the words by sTargetBusyCallback.
+ */
+void writeQueuedFlashPage() {
+    if (isBlank(sWritePage->Data, sFlashPageSize)) {
+        sNumberOfSkippedPages++;
+    } else {
+        writeFlashPage(sWritePage->PageAddress, sWritePage->Data, sFlashPageSize);
+        sNumberOfWrittenPages++;
+    }
+
+    sWritePage = NULL;
+    if (sFillPageComplete) {
+        queueFillPage();
+        if (sHeldByteValid) {
+            sHeldByteValid = false;
+            storeFlashByte(sHeldByteAddress, sHeldByte);
+        }
+    }
+}
+
+/*
+ * Receive one frame of the binary host protocol, execute it and send the response.
+ * Frames with wrong CRC are answered with STATUS_CRC_ERROR, incomplete frames are discarded.
+ */
+void handleBinaryFrame() {
+    uint8_t *tFrame = sFrameBuffer;
+    for (uint8_t i = 0; i < FRAME_HEADER_SIZE; ++i) {
+        if (!readFrameByte(&tFrame[i])) {
+            skipToNextFrame();
+            return;
+        }
+    }
+    uint8_t tLength = tFrame[3];
+#if MAX_FRAME_PAYLOAD_SIZE < 255
+    if (tLength > MAX_FRAME_PAYLOAD_SIZE) {
+        skipToNextFrame();
+        sendResponseFrame(tFrame[1], tFrame[2], STATUS_INVALID_ARGUMENT, 0);
+        return;
+    }
+#endif
+    uint16_t tCRC = 0xFFFF;
+    for (uint16_t i = 1; i < FRAME_HEADER_SIZE + tLength + FRAME_CRC_SIZE; ++i) {
+        if (i >= FRAME_HEADER_SIZE && !readFrameByte(&tFrame[i])) {
+            skipToNextFrame();
+            return;
+        }
+        if (i < FRAME_HEADER_SIZE + tLength) {
+            tCRC = _crc_ccitt_update(tCRC, tFrame[i]);
+        }
+    }
+    uint8_t tSequenceNumber = tFrame[1];
+    uint8_t tOpcode = tFrame[2];
+    if ((tFrame[FRAME_HEADER_SIZE + tLength] | (tFrame[FRAME_HEADER_SIZE + tLength + 1] << 8)) != tCRC) {
+        skipToNextFrame(); // The length byte may be corrupted too
+        sendResponseFrame(tSequenceNumber, tOpcode, STATUS_CRC_ERROR, 0);
+        return;
+    }
+
+    /*
+     * Payload and response data share the frame buffer. Response data starts behind the status byte.
+     * Commands copy their arguments before writing response data.
+     */
+    uint8_t tPayload[MAX_FRAME_PAYLOAD_SIZE];
+    memcpy(tPayload, &tFrame[FRAME_HEADER_SIZE], tLength);
+    uint8_t tResponseLength = 0;
+    uint8_t tStatus = executeBinaryCommand(tOpcode, tPayload, tLength, &tFrame[FRAME_HEADER_SIZE + 1], &tResponseLength);
+    sendResponseFrame(tSequenceNumber, tOpcode, tStatus, tResponseLength);
+}
+
+bool readFrameByte(uint8_t *aByte) {
+    uint32_t tStartMillis = millis();
+    while (Serial.available() == 0) {
+        if (millis() - tStartMillis > FRAME_BYTE_TIMEOUT_MILLIS) {
+            return false;
+        }
+    }
+    *aByte = Serial.read();
+    return true;
+}
+
+/*
+ * Discard the rest of an oversized, truncated or corrupted frame, so that none of its bytes is taken as a text command.
+ * Stops at the next sync byte, which may start the next frame, or if no byte is received for FRAME_BYTE_TIMEOUT_MILLIS.
+ * A sync byte inside of the discarded data only leads to another rejected frame.
+ */
+void skipToNextFrame() {
+    uint32_t tLastByteMillis = millis();
+    while (millis() - tLastByteMillis <= FRAME_BYTE_TIMEOUT_MILLIS) {
+        if (Serial.available() > 0) {
+            if (Serial.peek() == FRAME_SYNC) {
+                return;
+            }
+            Serial.read();
+            tLastByteMillis = millis();
+#if defined(HV_WATCHDOG)
+            wdt_reset(); // Continuous garbage is no hang
+#endif
+        }
+    }
+}
+
+/*
+ * @param aResponseData   Receives the response data, at most MAX_READ_LENGTH bytes
+ * @param aResponseLength Receives the number of bytes of response data
+ * @return status for response
+ */
+uint8_t executeBinaryCommand(uint8_t aOpcode, const uint8_t *aPayload, uint8_t aLength, uint8_t *aResponseData, uint8_t *aResponseLength) {
+    if (aOpcode == OPCODE_GET_VERSION) {
+        aResponseData[0] = PROTOCOL_VERSION;
+        aResponseData[1] = VERSION[0] - '0';
+        aResponseData[2] = VERSION[2] - '0';
+        aResponseData[3] = MAX_FRAME_PAYLOAD_SIZE;
+        *aResponseLength = 4;
+        return STATUS_OK;
+    }
+    if (aOpcode == OPCODE_POWER_DOWN) {
+        exitHVProgrammingMode();
+        digitalWrite(LED_BUILTIN, LOW);
+        return STATUS_OK;
+    }
+    if (aOpcode == OPCODE_READ_STATISTICS) {
+        if (aLength > 0 && aPayload[0] == 1) {
+            eeprom_read_block(aResponseData, &sStatisticsEEPROM, sizeof(Statistics));
+        } else {
+            memcpy(aResponseData, &sStatistics, sizeof(Statistics));
+        }
+        *aResponseLength = sizeof(Statistics);
+        return STATUS_OK;
+    }
+    if (aOpcode == OPCODE_CLEAR_STATISTICS) {
+        memset(&sStatistics, 0, sizeof(sStatistics));
+        return STATUS_OK;
+    }
+    if (aOpcode == OPCODE_SAVE_STATISTICS) {
+        eeprom_update_block(&sStatistics, &sStatisticsEEPROM, sizeof(Statistics));
+        return STATUS_OK;
+    }
+#if defined(HVSP_INSTRUMENTATION)
+    // Trace commands must not power up the target, this would add entries
+    if (aOpcode == OPCODE_READ_TRACE) {
+        uint8_t tOldest = sTraceWriteIndex - sTraceLength;
+        uint8_t tIndex = (aLength > 0) ? aPayload[0] : 0;
+        aResponseData[0] = sTraceLength;
+        uint8_t tLength = 1;
+        while (tIndex < sTraceLength && tLength + sizeof(TraceEntry) <= MAX_READ_LENGTH) {
+            memcpy(&aResponseData[tLength], &sTraceBuffer[(tOldest + tIndex) & (TRACE_BUFFER_SIZE - 1)], sizeof(TraceEntry));
+            tLength += sizeof(TraceEntry);
+            tIndex++;
+        }
+        *aResponseLength = tLength;
+        return STATUS_OK;
+    }
+    if (aOpcode == OPCODE_CLEAR_TRACE) {
+        sTraceWriteIndex = 0;
+        sTraceLength = 0;
+        return STATUS_OK;
+    }
+#endif
+
+    /*
+     * All other commands require the target in programming mode
+     */
+    if (aOpcode == OPCODE_POWER_UP || !sIsInProgrammingMode) {
+        if (sIsInProgrammingMode) {
+            exitHVProgrammingMode();
+        }
+        digitalWrite(LED_BUILTIN, HIGH);
+        enterHVProgrammingMode();
+        unsigned int tSignature = readSignature();
+        sCurrentDevicePGM = NULL;
+        if (sHVSPStatus == HVSP_OK) {
+            sCurrentDevicePGM = findDevice(tSignature);
+            if (sCurrentDevicePGM != NULL && !isDeviceSupported(sCurrentDevicePGM)) {
+                sCurrentDevicePGM = NULL;
+            }
+        }
+        if (aOpcode == OPCODE_POWER_UP) {
+            aResponseData[0] = tSignature;
+            aResponseData[1] = tSignature >> 8;
+            *aResponseLength = 2;
+            if (sHVSPStatus != HVSP_OK) {
+                return sHVSPStatus;
+            }
+            if (sCurrentDevicePGM == NULL) {
+                return STATUS_NO_DEVICE;
+            }
+            // Part data for the host, so it needs no copy of the device table
+            uint16_t tFlashSize = pgm_read_word(&sCurrentDevicePGM->FlashSize);
+            aResponseData[2] = tFlashSize;
+            aResponseData[3] = tFlashSize >> 8;
+            aResponseData[4] = pgm_read_byte(&sCurrentDevicePGM->FlashPageSize);
+            aResponseData[5] = pgm_read_byte(&sCurrentDevicePGM->NumberOfFuses);
+            uint8_t tNameLength = strlen_P(sCurrentDevicePGM->Name);
+            memcpy_P(&aResponseData[6], sCurrentDevicePGM->Name, tNameLength);
+            *aResponseLength = 6 + tNameLength;
+            return STATUS_OK;
+        }
+    }
+    sHVSPStatus = HVSP_OK; // Clear the sticky status of a previous command, but keep a pending busy timeout
+
+    if (aOpcode == OPCODE_READ_SIGNATURE) {
+        unsigned int tSignature = readSignature();
+        aResponseData[0] = tSignature;
+        aResponseData[1] = tSignature >> 8;
+        *aResponseLength = 2;
+        return sHVSPStatus;
+    }
+    if (aOpcode == OPCODE_READ_FUSES) {
+        *aResponseLength = MAX_NUMBER_OF_FUSES;
+        return runHVSPSequence(ReadFusesSequence, NULL, aResponseData);
+    }
+    if (aOpcode == OPCODE_IDENTIFY) {
+        *aResponseLength = sizeof(IdentifyResult);
+        return runHVSPSequence(IdentifySequence, NULL, aResponseData);
+    }
+
+    /*
+     * The following commands require a known part
+     */
+    if (sCurrentDevicePGM == NULL) {
+        return STATUS_NO_DEVICE;
+    }
+    uint16_t tAddress = aPayload[0] | (aPayload[1] << 8);
+    if (aOpcode == OPCODE_WRITE_FUSE) {
+        if (aLength != 2 || aPayload[0] >= pgm_read_byte(&sCurrentDevicePGM->NumberOfFuses)) {
+            return STATUS_INVALID_ARGUMENT;
+        }
+        writeFuseValue(pgm_read_word(&FuseWriteAddresses[aPayload[0]]), aPayload[1]);
+        return sHVSPStatus;
+    }
+    if (aOpcode == OPCODE_CHIP_ERASE) {
+        eraseChip();
+        return sHVSPStatus;
+    }
+    if (aOpcode == OPCODE_READ_FLASH || aOpcode == OPCODE_READ_EEPROM) {
+        uint8_t tReadLength = aPayload[2];
+        uint16_t tSize =
+                (aOpcode == OPCODE_READ_FLASH) ?
+                        pgm_read_word(&sCurrentDevicePGM->FlashSize) : pgm_read_word(&sCurrentDevicePGM->EEPROMSize);
+        if (aLength != 3 || tReadLength > MAX_READ_LENGTH || (uint32_t) tAddress + tReadLength > tSize) {
+            return STATUS_INVALID_ARGUMENT;
+        }
+        *aResponseLength = tReadLength;
+        if (aOpcode == OPCODE_READ_FLASH) {
+            readFlashBytes(tAddress, tReadLength, aResponseData);
+        } else {
+            readEEPROMBytes(tAddress, tReadLength, aResponseData);
+        }
+        return sHVSPStatus;
+    }
+    if (aOpcode == OPCODE_WRITE_FLASH_PAGE) {
+        uint8_t tPageSize = pgm_read_byte(&sCurrentDevicePGM->FlashPageSize);
+        if (aLength != 2 + tPageSize || (tAddress & (tPageSize - 1)) != 0
+                || tAddress >= pgm_read_word(&sCurrentDevicePGM->FlashSize)) {
+            return STATUS_INVALID_ARGUMENT;
+        }
+        if (!isBlank(&aPayload[2], tPageSize)) { // Blank pages need no write after the chip erase
+            writeFlashPage(tAddress, &aPayload[2], tPageSize);
+            waitForTargetReady();
+            runHVSPSequence(NoOperationSequence, NULL, NULL);
+        }
+        return sHVSPStatus;
+    }
+    if (aOpcode == OPCODE_BLANK_CHECK) {
+        uint16_t tFirstNonBlankAddress;
+        bool tIsBlank = blankCheckFlash(pgm_read_word(&sCurrentDevicePGM->FlashSize), &tFirstNonBlankAddress);
+        aResponseData[0] = tFirstNonBlankAddress;
+        aResponseData[1] = tFirstNonBlankAddress >> 8;
+        *aResponseLength = 2;
+        if (sHVSPStatus == HVSP_OK && !tIsBlank) {
+            return STATUS_NOT_BLANK;
+        }
+        return sHVSPStatus;
+    }
+    if (aOpcode == OPCODE_VERIFY_FLASH) {
+        uint16_t tLength = aPayload[2] | (aPayload[3] << 8);
+        if (aLength != 8 || (uint32_t) tAddress + tLength > pgm_read_word(&sCurrentDevicePGM->FlashSize)) {
+            return STATUS_INVALID_ARGUMENT;
+        }
+        uint32_t tCRC = computeFlashCRC32(tAddress, tLength);
+        memcpy(aResponseData, &tCRC, sizeof(tCRC)); // Little endian like the protocol
+        *aResponseLength = sizeof(tCRC);
+        if (sHVSPStatus == HVSP_OK && memcmp(&aPayload[4], &tCRC, sizeof(tCRC)) != 0) {
+            return STATUS_VERIFY_ERROR;
+        }
+        return sHVSPStatus;
+    }
+    if (aOpcode == OPCODE_VERIFY_FLASH_PAGES) {
+        uint8_t tPageSize = pgm_read_byte(&sCurrentDevicePGM->FlashPageSize);
+        uint8_t tNumberOfPages = (aLength - 2) / sizeof(uint32_t);
+        if (aLength < 2 || tNumberOfPages * sizeof(uint32_t) != aLength - 2u || (tAddress & (tPageSize - 1)) != 0
+                || (uint32_t) tAddress + (uint16_t) tNumberOfPages * tPageSize > pgm_read_word(&sCurrentDevicePGM->FlashSize)) {
+            return STATUS_INVALID_ARGUMENT;
+        }
+        for (uint8_t i = 0; i < tNumberOfPages; ++i) {
+            uint32_t tCRC = computeFlashCRC32(tAddress, tPageSize);
+            if (sHVSPStatus != HVSP_OK) {
+                return sHVSPStatus;
+            }
+            if (memcmp(&aPayload[2 + i * sizeof(uint32_t)], &tCRC, sizeof(tCRC)) != 0) {
+                aResponseData[0] = tAddress;
+                aResponseData[1] = tAddress >> 8;
+                *aResponseLength = 2;
+                return STATUS_VERIFY_ERROR;
+            }
+            tAddress += tPageSize;
+        }
+        return STATUS_OK;
+    }
+    if (aOpcode == OPCODE_WRITE_EEPROM) {
+        if (aLength < 2 || (uint32_t) tAddress + (aLength - 2) > pgm_read_word(&sCurrentDevicePGM->EEPROMSize)) {
+            return STATUS_INVALID_ARGUMENT;
+        }
+        writeEEPROMBytes(tAddress, aLength - 2, &aPayload[2], pgm_read_byte(&sCurrentDevicePGM->EEPROMPageSize));
+        return sHVSPStatus;
+    }
+    return STATUS_UNKNOWN_OPCODE;
+}
+
+/*
+ * Response data must already be in sFrameBuffer behind the status byte
+ */
+void sendResponseFrame(uint8_t aSequenceNumber, uint8_t aOpcode, uint8_t aStatus, uint8_t aLength) {
+    uint8_t *tFrame = sFrameBuffer;
+    tFrame[0] = FRAME_SYNC;
+    tFrame[1] = aSequenceNumber;
+    tFrame[2] = aOpcode | OPCODE_RESPONSE;
+    tFrame[3] = aLength + 1;
+    tFrame[4] = aStatus;
+    uint16_t tCRC = 0xFFFF;
+    uint16_t tCRCIndex = FRAME_HEADER_SIZE + 1 + aLength;
+    for (uint16_t i = 1; i < tCRCIndex; ++i) {
+        tCRC = _crc_ccitt_update(tCRC, tFrame[i]);
+    }
+    tFrame[tCRCIndex] = tCRC;
+    tFrame[tCRCIndex + 1] = tCRC >> 8;
+    Serial.write(tFrame, tCRCIndex + FRAME_CRC_SIZE);
 }